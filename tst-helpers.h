@@ -0,0 +1,296 @@
+/* -*- Mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil -*- */
+/*
+ * Helpers shared by the tst-* programs
+ *
+ * Copyright 2012 Ulrik Dickow
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/* Parts of this file come from Wine's dlls/msxml3/tests/domdoc.c */
+
+#ifndef TST_HELPERS_H
+#define TST_HELPERS_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "windows.h"
+#include "psapi.h"
+
+/***** Begin BSTR helper functions from dlls/msxml3/tests/domdoc.c *********************/
+
+static inline BSTR alloc_str_from_narrow(const char *str)
+{
+    int len = MultiByteToWideChar(CP_ACP, 0, str, -1, NULL, 0);
+    BSTR ret = SysAllocStringLen(NULL, len - 1);  /* NUL character added automatically */
+    MultiByteToWideChar(CP_ACP, 0, str, -1, ret, len);
+    return ret;
+}
+
+/* Unlike in domdoc.c, the BSTRs from _bstr_ are kept in a growable arena instead of a
+ * fixed table of 256, so long loops don't run out of slots.  free_bstrs() frees all of
+ * them; release_bstrs() frees only those allocated after a mark_bstrs(), so a loop body
+ * can clean up after itself without touching the strings of its caller.
+ * The arena is per thread, so the helpers can be used from several threads at once.
+ */
+struct bstr_arena
+{
+    BSTR *bstrs;
+    int count, size;
+};
+
+static __thread struct bstr_arena bstr_arena;
+
+static inline BSTR _bstr_(const char *str)
+{
+    if (bstr_arena.count == bstr_arena.size)
+    {
+        bstr_arena.size = (bstr_arena.size ? 2 * bstr_arena.size : 256);
+        bstr_arena.bstrs = realloc(bstr_arena.bstrs, bstr_arena.size * sizeof(BSTR));
+        assert(bstr_arena.bstrs != NULL);
+    }
+    bstr_arena.bstrs[bstr_arena.count] = alloc_str_from_narrow(str);
+    return bstr_arena.bstrs[bstr_arena.count++];
+}
+
+static inline int mark_bstrs(void)
+{
+    return bstr_arena.count;
+}
+
+static inline void release_bstrs(int mark)
+{
+    while (bstr_arena.count > mark)
+        SysFreeString(bstr_arena.bstrs[--bstr_arena.count]);
+}
+
+static inline void free_bstrs(void)
+{
+    release_bstrs(0);
+}
+
+static inline VARIANT _variantbstr_(const char *str)
+{
+    VARIANT v;
+    V_VT(&v) = VT_BSTR;
+    V_BSTR(&v) = _bstr_(str);
+    return v;
+}
+
+/***** End BSTR helper functions from dlls/msxml3/tests/domdoc.c ***********************/
+
+/* Interned BSTRs: the same string always gives the same BSTR, allocated only the first
+ * time, so names and namespace URIs used over and over in a loop cost a table lookup
+ * instead of a conversion and an allocation.  They stay until free_interned_bstrs(),
+ * so they must only be passed as [in] arguments, never be modified or freed by callees.
+ * Like the arena, the table is per thread.
+ */
+struct bstr_intern
+{
+    unsigned int hash;
+    char *key;              /* our own copy of the string; NULL marks a free slot */
+    BSTR bstr;
+};
+
+static __thread struct
+{
+    struct bstr_intern *entries;
+    int count, size;
+} bstr_interned;
+
+static inline unsigned int str_hash(const char *str)
+{
+    unsigned int hash = 2166136261u;  /* 32-bit FNV-1a */
+    while (*str) hash = (hash ^ (unsigned char)*str++) * 16777619u;
+    return hash;
+}
+
+static inline struct bstr_intern *find_interned(struct bstr_intern *entries, int size,
+                                                unsigned int hash, const char *str)
+{
+    int i = hash & (size - 1);
+
+    while (entries[i].key != NULL && (entries[i].hash != hash || strcmp(entries[i].key, str)))
+        i = (i + 1) & (size - 1);
+    return &entries[i];
+}
+
+static inline struct bstr_intern *intern_str(const char *str)
+{
+    struct bstr_intern *entry;
+    unsigned int hash = str_hash(str);
+
+    if (2 * (bstr_interned.count + 1) > bstr_interned.size)
+    {
+        struct bstr_intern *old = bstr_interned.entries;
+        int i, old_size = bstr_interned.size;
+
+        bstr_interned.size = (old_size ? 2 * old_size : 64);
+        bstr_interned.entries = calloc(bstr_interned.size, sizeof(*old));
+        assert(bstr_interned.entries != NULL);
+        for (i = 0; i < old_size; i++)
+            if (old[i].key != NULL)
+                *find_interned(bstr_interned.entries, bstr_interned.size,
+                               old[i].hash, old[i].key) = old[i];
+        free(old);
+    }
+    entry = find_interned(bstr_interned.entries, bstr_interned.size, hash, str);
+    if (entry->key == NULL)
+    {
+        entry->hash = hash;
+        entry->key = strdup(str);
+        assert(entry->key != NULL);
+        entry->bstr = alloc_str_from_narrow(str);
+        bstr_interned.count++;
+    }
+    return entry;
+}
+
+static inline BSTR _ibstr_(const char *str)
+{
+    return intern_str(str)->bstr;
+}
+
+static inline VARIANT _ivariantbstr_(const char *str)
+{
+    VARIANT v;
+    V_VT(&v) = VT_BSTR;
+    V_BSTR(&v) = _ibstr_(str);
+    return v;
+}
+
+static inline void free_interned_bstrs(void)
+{
+    int i;
+
+    for (i = 0; i < bstr_interned.size; i++)
+        if (bstr_interned.entries[i].key != NULL)
+        {
+            SysFreeString(bstr_interned.entries[i].bstr);
+            free(bstr_interned.entries[i].key);
+        }
+    free(bstr_interned.entries);
+    bstr_interned.entries = NULL;
+    bstr_interned.count = bstr_interned.size = 0;
+}
+
+/* Compile-time BSTRs.  CONST_BSTR("literal") lays the literal out like a BSTR, i.e. its
+ * byte length followed by the UTF-16 characters and a NUL, just like the hand-written
+ * xmlnsW arrays in tst-switch_strcmpW.c, but generated by the compiler from the literal.
+ * No conversion and no allocation at runtime.  Must never be freed or modified, so only
+ * use them as [in] arguments.  Needs C11 u"" literals and GNU statement expressions.
+ */
+#define CONST_BSTR(lit) \
+    ({ static const struct { DWORD len; WCHAR str[sizeof(u"" lit) / sizeof(WCHAR)]; } \
+           const_bstr_ = { sizeof(u"" lit) - sizeof(WCHAR), u"" lit }; \
+       (BSTR)const_bstr_.str; })
+
+/* A narrow string for log output together with the BSTR passed to msxml.
+ * CSTR("literal") makes both at compile time; strings made at runtime can be interned
+ * with cstr_interned(), which returns the table's own copies, so the caller's buffer
+ * may be reused right away.
+ */
+struct cstr
+{
+    const char *a;
+    BSTR w;
+};
+
+#define CSTR(lit) ((struct cstr){ lit, CONST_BSTR(lit) })
+
+static inline struct cstr cstr_interned(const char *str)
+{
+    struct bstr_intern *entry = intern_str(str);
+    struct cstr ret = { entry->key, entry->bstr };
+    return ret;
+}
+
+static inline VARIANT cstr_variant(struct cstr str)
+{
+    VARIANT v;
+    V_VT(&v) = VT_BSTR;
+    V_BSTR(&v) = str.w;
+    return v;
+}
+
+/***** Timing and memory helpers for the benchmarks ***********************************/
+
+/* Private bytes of the process (needs -lpsapi on old Windows versions) */
+static inline SIZE_T private_bytes(void)
+{
+    PROCESS_MEMORY_COUNTERS counters;
+
+    counters.cb = sizeof(counters);
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return counters.PagefileUsage;
+}
+
+static inline double now_ms(void)
+{
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER count;
+
+    if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return 1000.0 * count.QuadPart / freq.QuadPart;
+}
+
+/* A growing set of timings (in ms) to take the minimum, median, percentiles and sum of */
+struct samples
+{
+    double *v;
+    int count, size;
+    double total;
+};
+
+static inline void samples_add(struct samples *s, double ms)
+{
+    if (s->count == s->size)
+    {
+        s->size = (s->size ? 2 * s->size : 1024);
+        s->v = realloc(s->v, s->size * sizeof(*s->v));
+        assert(s->v != NULL);
+    }
+    s->v[s->count++] = ms;
+    s->total += ms;
+}
+
+static inline void samples_clear(struct samples *s)
+{
+    s->count = 0;
+    s->total = 0.0;
+}
+
+static inline int samples_cmp(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/* Return the given percentile (0 = min, 50 = median, 100 = max); sorts the samples */
+static inline double samples_percentile(struct samples *s, double percent)
+{
+    int i;
+
+    if (s->count == 0) return 0.0;
+    qsort(s->v, s->count, sizeof(*s->v), samples_cmp);
+    i = (int)(percent / 100.0 * (s->count - 1) + 0.5);
+    return s->v[i];
+}
+
+#endif /* TST_HELPERS_H */
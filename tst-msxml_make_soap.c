@@ -44,6 +44,7 @@
  * -- and that we expand the test to also produce a few variations of this, possibly with
  * slightly different meanings, especially to find differences between the native and the
  * Wine msxml3 behaviour.
+ * Options -n, -d and -v grow the Login payload again, to see how the calls scale.
  */
 
 /* Build with: winegcc -m32 ... -lole32 -loleaut32 -luuid */
@@ -52,6 +53,10 @@
 #define CONST_VTABLE
 
 #include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
 #include <assert.h>
 
 #include "windows.h"
@@ -61,6 +66,8 @@
 #include "ole2.h"
 #include "dispex.h"
 
+#include "tst-helpers.h"
+
 #ifdef OLD_WINE
 #define PRIxHR "x"
 #else
@@ -73,68 +80,474 @@
 #define RELEASE_ELEMENT(e) \
     do { if (e != NULL) IXMLDOMElement_Release(e); } while(0)
 
-/* Simple hack from dlls/oleaut32/tests/vartype.c (but with increased buffer size here): */
-static const char* wtoascii(LPWSTR lpszIn)
+/* Output of a single case.  The parallel sweep collects it here per case and prints
+ * everything in HOW order afterwards, so the output is the same as for a serial run.
+ */
+struct out_buf
+{
+    char *data;
+    size_t len, size;
+};
+
+static __thread struct out_buf *cur_out;  /* NULL: print directly to out_file */
+static FILE *out_file;                     /* -o FILE, or stdout */
+static BOOL out_quiet;                     /* -q: suppress the output of the cases */
+
+static void out_buf_reserve(struct out_buf *out, size_t len)
 {
-    static char buff[2048];
-    WideCharToMultiByte(CP_ACP, 0, lpszIn, -1, buff, sizeof(buff), NULL, NULL);
-    return buff;
+    if (out->size - out->len >= len) return;
+
+    out->size = (out->size ? 2 * out->size : 4096);
+    if (out->size < out->len + len) out->size = out->len + len;
+    out->data = realloc(out->data, out->size);
+    assert(out->data != NULL);
 }
 
-/***** Begin BSTR helper functions from dlls/msxml3/tests/domdoc.c *********************/
+static void out_write(const void *data, size_t len)
+{
+    struct out_buf *out = cur_out;
+
+    if (out_quiet) return;
 
-static BSTR alloc_str_from_narrow(const char *str)
+    if (out == NULL)
+        fwrite(data, 1, len, out_file);
+    else
+    {
+        out_buf_reserve(out, len);
+        memcpy(out->data + out->len, data, len);
+        out->len += len;
+    }
+}
+
+/* Write UTF-16 text as UTF-8, converting a chunk at a time through a small buffer, so
+ * documents of any size come out whole without a full-size copy.  (wtoascii, used
+ * before, truncated at 2 KB and depended on the ANSI code page.)
+ */
+static void out_write_wide(const WCHAR *str, size_t len)
 {
-    int len = MultiByteToWideChar(CP_ACP, 0, str, -1, NULL, 0);
-    BSTR ret = SysAllocStringLen(NULL, len - 1);  /* NUL character added automatically */
-    MultiByteToWideChar(CP_ACP, 0, str, -1, ret, len);
-    return ret;
+    char buf[4096];
+
+    while (len > 0)
+    {
+        /* At most 3 bytes per UTF-16 unit; never split a surrogate pair */
+        int n = (len > sizeof(buf) / 3 ? sizeof(buf) / 3 : len);
+        if (n < len && str[n - 1] >= 0xd800 && str[n - 1] <= 0xdbff) n--;
+
+        out_write(buf, WideCharToMultiByte(CP_UTF8, 0, str, n, buf, sizeof(buf), NULL, NULL));
+        str += n;
+        len -= n;
+    }
+}
+
+static void out_printf(const char *fmt, ...)
+{
+    struct out_buf *out = cur_out;
+    va_list args;
+    int len;
+
+    if (out_quiet) return;
+
+    va_start(args, fmt);
+    if (out == NULL)
+        vfprintf(out_file, fmt, args);
+    else
+    {
+        for (;;)
+        {
+            size_t room = out->size - out->len;
+            va_list copy;
+
+            va_copy(copy, args);
+            len = (room ? vsnprintf(out->data + out->len, room, fmt, copy) : -1);
+            va_end(copy);
+            if (len >= 0 && len < room) break;
+
+            /* Old msvcrt returns -1 when truncating, so we may have to guess the size */
+            out_buf_reserve(out, (len >= 0 ? len + 1 : room + 1));
+        }
+        out->len += len;
+    }
+    va_end(args);
+}
+
+/* A write-only IStream passing everything written to it on to the case output, so that
+ * IXMLDOMDocument::save() can write the document without ever making a BSTR of it.
+ * There's just one static instance; the output it writes to is per thread.
+ */
+static __thread ULONGLONG out_stream_pos;
+
+static HRESULT WINAPI out_stream_QueryInterface(IStream *iface, REFIID riid, void **obj)
+{
+    if (IsEqualIID(riid, &IID_IUnknown) || IsEqualIID(riid, &IID_ISequentialStream) ||
+        IsEqualIID(riid, &IID_IStream))
+    {
+        *obj = iface;
+        return S_OK;
+    }
+    *obj = NULL;
+    return E_NOINTERFACE;
 }
 
-static BSTR alloced_bstrs[256];
-static int alloced_bstrs_count;
+static ULONG WINAPI out_stream_AddRef(IStream *iface)
+{
+    return 2;
+}
 
-static BSTR _bstr_(const char *str)
+static ULONG WINAPI out_stream_Release(IStream *iface)
 {
-    assert(alloced_bstrs_count < sizeof(alloced_bstrs)/sizeof(alloced_bstrs[0]));
-    alloced_bstrs[alloced_bstrs_count] = alloc_str_from_narrow(str);
-    return alloced_bstrs[alloced_bstrs_count++];
+    return 1;
 }
 
-static void free_bstrs(void)
+static HRESULT WINAPI out_stream_Read(IStream *iface, void *buf, ULONG len, ULONG *read)
 {
-    int i;
-    for (i = 0; i < alloced_bstrs_count; i++)
-        SysFreeString(alloced_bstrs[i]);
-    alloced_bstrs_count = 0;
+    return E_NOTIMPL;
+}
+
+static HRESULT WINAPI out_stream_Write(IStream *iface, const void *buf, ULONG len,
+                                       ULONG *written)
+{
+    out_write(buf, len);
+    out_stream_pos += len;
+    if (written) *written = len;
+    return S_OK;
+}
+
+static HRESULT WINAPI out_stream_Seek(IStream *iface, LARGE_INTEGER move, DWORD origin,
+                                      ULARGE_INTEGER *new_pos)
+{
+    /* Only asking for the current position is supported */
+    if (move.QuadPart != 0 || origin != STREAM_SEEK_CUR) return E_NOTIMPL;
+    if (new_pos) new_pos->QuadPart = out_stream_pos;
+    return S_OK;
+}
+
+static HRESULT WINAPI out_stream_SetSize(IStream *iface, ULARGE_INTEGER size)
+{
+    return E_NOTIMPL;
+}
+
+static HRESULT WINAPI out_stream_CopyTo(IStream *iface, IStream *dest, ULARGE_INTEGER len,
+                                        ULARGE_INTEGER *read, ULARGE_INTEGER *written)
+{
+    return E_NOTIMPL;
+}
+
+static HRESULT WINAPI out_stream_Commit(IStream *iface, DWORD flags)
+{
+    return S_OK;
+}
+
+static HRESULT WINAPI out_stream_Revert(IStream *iface)
+{
+    return E_NOTIMPL;
+}
+
+static HRESULT WINAPI out_stream_LockRegion(IStream *iface, ULARGE_INTEGER offset,
+                                            ULARGE_INTEGER len, DWORD type)
+{
+    return E_NOTIMPL;
+}
+
+static HRESULT WINAPI out_stream_UnlockRegion(IStream *iface, ULARGE_INTEGER offset,
+                                              ULARGE_INTEGER len, DWORD type)
+{
+    return E_NOTIMPL;
+}
+
+static HRESULT WINAPI out_stream_Stat(IStream *iface, STATSTG *stat, DWORD flags)
+{
+    return E_NOTIMPL;
+}
+
+static HRESULT WINAPI out_stream_Clone(IStream *iface, IStream **clone)
+{
+    return E_NOTIMPL;
+}
+
+static const IStreamVtbl out_stream_vtbl =
+{
+    out_stream_QueryInterface,
+    out_stream_AddRef,
+    out_stream_Release,
+    out_stream_Read,
+    out_stream_Write,
+    out_stream_Seek,
+    out_stream_SetSize,
+    out_stream_CopyTo,
+    out_stream_Commit,
+    out_stream_Revert,
+    out_stream_LockRegion,
+    out_stream_UnlockRegion,
+    out_stream_Stat,
+    out_stream_Clone
+};
+
+static IStream out_stream = { &out_stream_vtbl };
+
+static BOOL save_to_stream;  /* -s: write the XML via save() instead of get_xml */
+
+/* Quality ratings of the generated XML, see doc/tst-msxml_make_soap_results.txt */
+enum soap_rating
+{
+    RATE_NONE  = 0,
+    RATE_OPTIM = 1,     /* Perfect, optimized, no redundant declarations */
+    RATE_EQUIV = 2,     /* NS bindings needlessly repeated in children */
+    RATE_DANG  = 4,     /* Dangerously close to different meaning */
+    RATE_DIFF  = 5,     /* Valid XML, but different meaning than wanted */
+    RATE_SILLY = 8,     /* Same NS binding given twice in a row */
+    RATE_FAIL  = 9      /* S_OK was NOT returned by all functions */
+};
+
+/* Allocations through IMalloc seen by the allocation profiler (-M) */
+struct alloc_stats
+{
+    int calls;              /* DOM calls (per operation only) */
+    int allocs, frees;
+    SIZE_T bytes;           /* requested by the allocations */
+};
+
+/* One HOW value of a sweep together with its results */
+struct soap_case
+{
+    int how;
+    double ms;              /* wall time, < 0 if no document could be created */
+    struct out_buf out;     /* collected output (parallel sweep only) */
+    int calls;              /* number of DOM calls checked with CHK_HR & co. */
+    HRESULT first_failure;  /* first of these calls not returning S_OK, or S_OK */
+    enum soap_rating rating;
+    const char *reason;     /* why the rating isn't 1_Optim */
+    BOOL has_xml;           /* get_xml succeeded, so the hashes are valid */
+    ULONGLONG raw_hash;     /* of the XML as returned by get_xml */
+    ULONGLONG canon_hash;   /* of its namespace-canonicalized form */
+    BOOL cached;            /* result taken from the result cache (-c), not run */
+    struct alloc_stats allocs;  /* made during the case (-M) */
+    int live;               /* of these, the ones not freed at the end of the case */
+    SIZE_T live_bytes;
+    LONG doc_refs;          /* references to the document left over by the case */
+    LONG private_kb;        /* growth of the private bytes */
+};
+
+static __thread struct soap_case *cur_case;
+
+/* Record the result of a DOM call in the HRESULT trail of the current case */
+static void note_hr(HRESULT hr)
+{
+    struct soap_case *c = cur_case;
+
+    if (c == NULL) return;
+    c->calls++;
+    if (hr != S_OK && c->first_failure == S_OK)
+        c->first_failure = hr;
+}
+
+/* The DOM calls timed per operation by the benchmark (-b) */
+enum dom_op
+{
+    OP_CREATE_ELEMENT,
+    OP_CREATE_NODE_ELEM,
+    OP_CREATE_NODE_ATTR,
+    OP_PUT_NODE_VALUE,
+    OP_SET_ATTRIBUTE,
+    OP_SET_ATTRIBUTE_NODE,
+    OP_APPEND_CHILD,
+    OP_CREATE_PI,
+    OP_CREATE_TEXT,
+    OP_GET_XML,
+    OP_SAVE,
+    OP_CREATE_DOC,
+    OP_CONFIGURE_DOC,
+    OP_RESET_DOC,
+    OP_CLONE_TEMPLATE,
+    OP_COUNT
+};
+
+static const char * const op_names[OP_COUNT] =
+{
+    "createElement",
+    "createNode (element)",
+    "createNode (attribute)",
+    "put_nodeValue",
+    "setAttribute",
+    "setAttributeNode",
+    "appendChild",
+    "createProcessingInstruction",
+    "createTextNode",
+    "get_xml",
+    "save",
+    "CoCreateInstance (document)",
+    "document properties",
+    "reset document (-R)",
+    "cloneNode (template, -T)",
+};
+
+static BOOL bench_ops;                      /* -b: time every DOM call */
+static __thread double op_start_ms;
+static struct samples op_samples[OP_COUNT]; /* the benchmark runs in the main thread only */
+
+static BOOL profile_allocs;                 /* -M: count IMalloc use, main thread only */
+static struct alloc_stats op_allocs[OP_COUNT];
+static struct alloc_stats pending_allocs;   /* since the last op_start() */
+
+static inline void op_start(void)
+{
+    if (bench_ops) op_start_ms = now_ms();
+    if (profile_allocs) memset(&pending_allocs, 0, sizeof(pending_allocs));
+}
+
+static inline void op_done(enum dom_op op)
+{
+    if (bench_ops) samples_add(&op_samples[op], now_ms() - op_start_ms);
+    if (profile_allocs)
+    {
+        op_allocs[op].calls++;
+        op_allocs[op].allocs += pending_allocs.allocs;
+        op_allocs[op].frees += pending_allocs.frees;
+        op_allocs[op].bytes += pending_allocs.bytes;
+    }
+}
+
+/* With -L the checked calls aren't logged one by one, but recorded in a per-thread ring
+ * buffer of the last TRACE_SIZE calls: the format, the HRESULT, the arguments and a
+ * timestamp.  The ring is only formatted at the end of a case with a failing call, so
+ * a sweep doesn't spend its time in stdio.  The format takes %s (strings that must
+ * outlive the case, i.e. literals or interned), %d, %u and %x, with flags and width.
+ */
+#define TRACE_SIZE 256
+#define TRACE_ARGS 4
+
+struct trace_entry
+{
+    const char *fmt;
+    HRESULT hr;
+    double ms;
+    union
+    {
+        const char *s;
+        int d;
+    } args[TRACE_ARGS];
+};
+
+static BOOL trace_calls;                    /* -L */
+
+static __thread struct
+{
+    struct trace_entry entries[TRACE_SIZE];
+    unsigned int count;                     /* recorded since trace_start() */
+    double start_ms;
+} trace;
+
+static inline const char *hr_status(HRESULT hr)
+{
+    return (hr == S_OK ? "ok" : (hr == S_FALSE ? "False" : "FAIL"));
+}
+
+static void trace_start(void)
+{
+    trace.count = 0;
+    trace.start_ms = now_ms();
+}
+
+/* Skip a conversion specification, returning its conversion character */
+static char trace_conversion(const char **fmt)
+{
+    const char *p = *fmt + 1;
+
+    while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0' ||
+           (*p >= '1' && *p <= '9'))
+        p++;
+    *fmt = p;
+    return *p;
 }
 
-static VARIANT _variantbstr_(const char *str)
+static void trace_hr(HRESULT hr, const char *fmt, ...)
 {
-    VARIANT v;
-    V_VT(&v) = VT_BSTR;
-    V_BSTR(&v) = _bstr_(str);
-    return v;
+    struct trace_entry *entry = &trace.entries[trace.count++ % TRACE_SIZE];
+    const char *p;
+    va_list args;
+    int n = 0;
+
+    entry->fmt = fmt;
+    entry->hr = hr;
+    entry->ms = now_ms();
+    va_start(args, fmt);
+    for (p = fmt; *p != '\0' && n < TRACE_ARGS; p++)
+    {
+        if (*p != '%') continue;
+        switch (trace_conversion(&p))
+        {
+        case 's': entry->args[n++].s = va_arg(args, const char *); break;
+        case 'd': case 'u': case 'x': entry->args[n++].d = va_arg(args, int); break;
+        case '\0': p--; break;
+        default: break;
+        }
+    }
+    va_end(args);
 }
 
-/***** End BSTR helper functions from dlls/msxml3/tests/domdoc.c ***********************/
+/* Format the ring into the case output, oldest call first */
+static void trace_print(int how)
+{
+    unsigned int i = (trace.count > TRACE_SIZE ? trace.count - TRACE_SIZE : 0);
+
+    out_printf("---------- Trace of how = %d (%u calls", how, trace.count);
+    if (i > 0) out_printf(", first %u dropped", i);
+    out_printf(") ----------\n");
+    for (; i < trace.count; i++)
+    {
+        const struct trace_entry *entry = &trace.entries[i % TRACE_SIZE];
+        const char *p, *seg;
+        int n = 0;
+
+        out_printf("%10.3f us  %-5s <-- ", 1000.0 * (entry->ms - trace.start_ms),
+                   hr_status(entry->hr));
+        for (p = seg = entry->fmt; *p != '\0'; p++)
+        {
+            char spec[16];
+            const char *start = p;
+            char conv;
+
+            if (*p != '%') continue;
+            out_write(seg, p - seg);
+            if ((conv = trace_conversion(&p)) == '\0' || p - start + 2 > sizeof(spec))
+            {
+                seg = p;
+                break;
+            }
+            seg = p + 1;
+            memcpy(spec, start, p - start + 1);
+            spec[p - start + 1] = '\0';
+            if (conv == '%' || n == TRACE_ARGS)
+                out_write(spec + 1, conv == '%');
+            else if (conv == 's')
+                out_printf(spec, entry->args[n++].s);
+            else
+                out_printf(spec, entry->args[n++].d);
+        }
+        out_write(seg, strlen(seg));
+    }
+}
 
 /* Helper macro to log the important calls, including interesting arguments, no matter
  * the return status, but returning from the current function if HRESULT hr is not ok.
  */
 #define CHK_HR(fmt,args...) \
-    do { printf("%-5s <-- " fmt , (hr == S_OK ? "ok" : \
-                                 (hr == S_FALSE ? "False" : "FAIL")) , ##args); \
+    do { note_hr(hr); \
+         if (trace_calls) { if (!out_quiet) trace_hr(hr, fmt , ##args); } \
+         else out_printf("%-5s <-- " fmt , hr_status(hr) , ##args); \
          if (hr != S_OK) goto CleanReturn; \
     } while(0)
 
 /* Easy way of setting an attribute, but without any connection to namespaces
  * (native msxml3 treats xmlns* like any other attribute, possibly giving silly xml).
  */
-static HRESULT set_attr_easy(IXMLDOMElement *elem, const char *attr, const char *str_val)
+static HRESULT set_attr_easy(IXMLDOMElement *elem, struct cstr attr, struct cstr str_val)
 {
-    HRESULT hr = IXMLDOMElement_setAttribute(elem, _bstr_(attr), _variantbstr_(str_val));
-    CHK_HR("  setAttribute (attr = \"%s\", value = \"%s\"\n", attr, str_val);
+    HRESULT hr;
+
+    op_start();
+    hr = IXMLDOMElement_setAttribute(elem, attr.w, cstr_variant(str_val));
+    op_done(OP_SET_ATTRIBUTE);
+    CHK_HR("  setAttribute (attr = \"%s\", value = \"%s\"\n", attr.a, str_val.a);
 
 CleanReturn:
     return hr;
@@ -153,20 +566,20 @@ CleanReturn:
  * given element node.
  * Actually we begin by crawling back from element to doc (trace does that too).
  */
-static HRESULT set_attr_cplx(IXMLDOMElement *elem, const char *attr, const char *str_val)
+static HRESULT set_attr_cplx(IXMLDOMElement *elem, struct cstr attr, struct cstr str_val)
 {
-    const char *nsURI = "http://www.w3.org/2000/xmlns/";
+    struct cstr nsURI = CSTR("http://www.w3.org/2000/xmlns/");
     HRESULT hr;
     VARIANT var;
     IXMLDOMDocument *doc;
     IXMLDOMNode *node;
-    IXMLDOMAttribute *attr_node, *attr_old;
+    IXMLDOMAttribute *attr_node = NULL, *attr_old = NULL;
 
     /* 0) Find doc from given element */
     hr = IXMLDOMElement_get_ownerDocument(elem, &doc);
     if (hr != S_OK)
     {   /* This error should never happen. */
-        printf("set_attr_cplx: failed to find doc from elem\n");
+        out_printf("set_attr_cplx: failed to find doc from elem\n");
         return hr;
     }
 
@@ -174,27 +587,36 @@ static HRESULT set_attr_cplx(IXMLDOMElement *elem, const char *attr, const char
     V_VT(&var) = VT_I4;  // VT_I1 often used, but I4 seen in trace, so use that now
     V_I4(&var) = NODE_ATTRIBUTE;
 
-    hr = IXMLDOMDocument_createNode(doc, var, _bstr_(attr), _bstr_(nsURI), &node);
+    op_start();
+    hr = IXMLDOMDocument_createNode(doc, var, attr.w, nsURI.w, &node);
+    op_done(OP_CREATE_NODE_ATTR);
 
     CHK_HR("  createNode (type = NODE_ATTRIBUTE, attr = \"%s\", nsURI = \"%s\")\n",
-           attr, nsURI);
+           attr.a, nsURI.a);
 
     IXMLDOMNode_QueryInterface(node, &IID_IXMLDOMAttribute, (void**) &attr_node);
     IXMLDOMNode_Release(node);
 
     /* 2) Put attribute value into attribute node */
-    hr = IXMLDOMAttribute_put_nodeValue(attr_node, _variantbstr_(str_val));
-    CHK_HR("    put_nodeValue (value = \"%s\")\n", str_val);
+    op_start();
+    hr = IXMLDOMAttribute_put_nodeValue(attr_node, cstr_variant(str_val));
+    op_done(OP_PUT_NODE_VALUE);
+    CHK_HR("    put_nodeValue (value = \"%s\")\n", str_val.a);
 
     /* 3) Connect/transfer our new attribute node to the given element node */
+    op_start();
     hr = IXMLDOMElement_setAttributeNode(elem, attr_node, &attr_old);
+    op_done(OP_SET_ATTRIBUTE_NODE);
     CHK_HR("    setAttributeNode\n");
 
 CleanReturn:
+    if (attr_old != NULL) IXMLDOMAttribute_Release(attr_old);
+    if (attr_node != NULL) IXMLDOMAttribute_Release(attr_node);
+    IXMLDOMDocument_Release(doc);
     return hr;
 }
 
-static HRESULT set_attr(IXMLDOMElement *elem, const char *attr, const char *str_val,
+static HRESULT set_attr(IXMLDOMElement *elem, struct cstr attr, struct cstr str_val,
                         BOOL use_node)
 {
     return (use_node ? set_attr_cplx(elem, attr, str_val)
@@ -207,21 +629,24 @@ static HRESULT set_attr(IXMLDOMElement *elem, const char *attr, const char *str_
  * in fact we forbid it.
  * The body is mostly a copy of domdoc_createElement, minus some error checking & debug.
  */
-static IXMLDOMElement* create_elem_ns(IXMLDOMDocument *doc, const char *name,
-                                      const char *nsURI)
+static IXMLDOMElement* create_elem_ns(IXMLDOMDocument *doc, struct cstr name,
+                                      struct cstr nsURI)
 {
     VARIANT type;
     HRESULT hr;
     IXMLDOMNode *node;
     IXMLDOMElement* element = NULL;
 
-    assert(nsURI != NULL);
+    assert(nsURI.a != NULL);
 
     V_VT(&type) = VT_I1;
     V_I1(&type) = NODE_ELEMENT;
 
-    hr = IXMLDOMDocument_createNode(doc, type, _bstr_(name), _bstr_(nsURI), &node);
-    CHK_HR("createNode (type = NODE_ELEMENT, name = \"%s\", nsURI = \"%s\")\n", name, nsURI);
+    op_start();
+    hr = IXMLDOMDocument_createNode(doc, type, name.w, nsURI.w, &node);
+    op_done(OP_CREATE_NODE_ELEM);
+    CHK_HR("createNode (type = NODE_ELEMENT, name = \"%s\", nsURI = \"%s\")\n",
+           name.a, nsURI.a);
 
     IXMLDOMNode_QueryInterface(node, &IID_IXMLDOMElement, (void**) &element);
     IXMLDOMNode_Release(node);
@@ -240,8 +665,8 @@ CleanReturn:
  * not intended for use in this test (e.g. xmlns:xsd is not created by this function).
  */
 static IXMLDOMElement* create_elem_multi(IXMLDOMDocument *doc,    IXMLDOMElement *parent,
-                                         const char *name,        const char *xmlns_attr,
-                                         const char *nsURI,       BOOL use_create_element,
+                                         struct cstr name,        struct cstr xmlns_attr,
+                                         struct cstr nsURI,       BOOL use_create_element,
                                          BOOL set_nsuri_full,     BOOL add_ns_as_attrib,
                                          BOOL use_attrib_nodes,   BOOL set_attrib_delayed)
 {
@@ -250,11 +675,13 @@ static IXMLDOMElement* create_elem_multi(IXMLDOMDocument *doc,    IXMLDOMElement
 
     if (use_create_element)
     {
-        hr = IXMLDOMDocument_createElement(doc, _bstr_(name), &elem);
-        CHK_HR("createElement (name = \"%s\")\n", name);
+        op_start();
+        hr = IXMLDOMDocument_createElement(doc, name.w, &elem);
+        op_done(OP_CREATE_ELEMENT);
+        CHK_HR("createElement (name = \"%s\")\n", name.a);
     }
     else
-        elem = create_elem_ns(doc, name, (set_nsuri_full ? nsURI : ""));
+        elem = create_elem_ns(doc, name, (set_nsuri_full ? nsURI : CSTR("")));
 
     if (elem == NULL) return NULL;
 
@@ -263,8 +690,10 @@ static IXMLDOMElement* create_elem_multi(IXMLDOMDocument *doc,    IXMLDOMElement
 
     if (parent != NULL)
     {
+        op_start();
         hr = IXMLDOMElement_appendChild(parent, (IXMLDOMNode*)elem, NULL);
-        CHK_HR("  appendChild (child element = \"%s\")\n", name);
+        op_done(OP_APPEND_CHILD);
+        CHK_HR("  appendChild (child element = \"%s\")\n", name.a);
     }
 
     if (set_attrib_delayed && add_ns_as_attrib)
@@ -348,134 +777,3582 @@ CleanReturn:
  *   how12 = 0: Setting of attributes is done BEFORE connecting element node to parent element
  */
 
+/* Many flags make no difference in the presence of others.  Clearing them gives the
+ * canonical representative of the HOW values that make exactly the same calls, and so
+ * the same document and rating:
+ *  - M_SET_*_URI_FULL only matters for createNode, not with the M_USE_*_CREATE_ELEM of
+ *    the same element;
+ *  - M_SET_ATTRIB_DELAYED only matters if xmlns attributes are added at all, with
+ *    M_ADD_NS_ATTRIB_TOP or M_ADD_NS_ATTRIB_INNER.
+ * M_USE_ATTRIB_NODES always matters, as xmlns:xsd and xmlns:xsi are set in any case.
+ * This leaves 2268 of the 8192 values.
+ */
+static int canonical_how(int how)
+{
+    static const int create_uri[][2] =
+    {
+        { M_USE_ENVE_CREATE_ELEM,  M_SET_ENVE_URI_FULL },
+        { M_USE_BODY_CREATE_ELEM,  M_SET_BODY_URI_FULL },
+        { M_USE_LOGIN_CREATE_ELEM, M_SET_LOGIN_URI_FULL },
+        { M_USE_CODE_CREATE_ELEM,  M_SET_CODE_URI_FULL },
+    };
+    int i;
+
+    for (i = 0; i < sizeof(create_uri) / sizeof(create_uri[0]); i++)
+        if (how & create_uri[i][0])
+            how &= ~create_uri[i][1];
+    if (!(how & (M_ADD_NS_ATTRIB_TOP | M_ADD_NS_ATTRIB_INNER)))
+        how &= ~M_SET_ATTRIB_DELAYED;
+    return how;
+}
+
 #define CHK_NULL(expression) \
     do { if ((expression) == NULL) goto CleanReturn; } while(0)
 
-/* Try building a SOAP request step-by-step like in the Visual Basic example
- *    http://blogs.msdn.com/b/jpsanders/archive/2007/06/14/how-to-send-soap-call-using-msxml-replace-stk.aspx
- * to reproduce approximately the SOAP output of BridgeCentral w/ the native dll (winetricks).
- * Wine's msxml3 currently chokes on the calls made by BridgeCentral, spoiling its SOAP login.
- * The how argument is interpreted as explained above.
- */
-static void test_build_soap(IXMLDOMDocument *doc, int how)
+/***** Automatic rating of the generated XML ******************************************/
+
+#define SOAP_ENV_URI    "http://schemas.xmlsoap.org/soap/envelope/"
+#define WSO2_URI        "http://www.wso2.org/php/xsd"
+#define XSD_URI         "http://www.w3.org/2001/XMLSchema"
+#define XSI_URI         "http://www.w3.org/2001/XMLSchema-instance"
+
+static const char *rating_name(enum soap_rating rating)
 {
-    HRESULT hr;
-    IXMLDOMProcessingInstruction *nodePI = NULL;
-    IXMLDOMElement *soapEnvelope = NULL, *soapBody = NULL, *soapCall = NULL, *soapArg1 = NULL;
+    switch (rating)
+    {
+    case RATE_OPTIM: return "1_Optim";
+    case RATE_EQUIV: return "2_equiv";
+    case RATE_DANG:  return "4_dang";
+    case RATE_DIFF:  return "5_diff";
+    case RATE_SILLY: return "8_silly";
+    case RATE_FAIL:  return "9_FAIL";
+    default:         return "-";
+    }
+}
 
-    BSTR xml;
-    BOOL use_an   = ((how & M_USE_ATTRIB_NODES) != 0);
-    BOOL add_nsa1 = ((how & M_ADD_NS_ATTRIB_TOP) != 0);
-    BOOL add_nsa2 = ((how & M_ADD_NS_ATTRIB_INNER) != 0);
-    BOOL a_delay  = ((how & M_SET_ATTRIB_DELAYED) != 0);
+/* A namespace binding (xmlns[:prefix]="uri") as seen in the serialized XML */
+struct xml_binding
+{
+    const WCHAR *prefix, *uri;
+    int prefix_len, uri_len;    /* prefix_len 0 is the default namespace */
+};
 
-    /* First set attributes like BridgeCentral would do in its request */
-    IXMLDOMDocument_put_preserveWhiteSpace(doc, VARIANT_FALSE);
-    IXMLDOMDocument_put_resolveExternals(doc, VARIANT_FALSE);
-    IXMLDOMDocument_put_validateOnParse(doc, VARIANT_FALSE);
-    IXMLDOMDocument_put_async(doc, VARIANT_FALSE);
+/* Bindings in scope while scanning, kept per thread and reused between documents */
+struct xml_scope
+{
+    struct xml_binding *bindings;
+    int nbindings, bindings_size;
+    int *elem_start;            /* index of the first binding of each open element */
+    int depth, depth_size;
+};
 
-    hr = IXMLDOMDocument_createProcessingInstruction(doc, _bstr_("xml"),
-                                                     _bstr_("version=\"1.0\""), &nodePI);
-    if(hr != S_OK || nodePI == NULL)
+static __thread struct xml_scope scope;
+
+static BOOL span_is(const WCHAR *str, int len, const char *ascii)
+{
+    int i;
+    for (i = 0; i < len; i++)
+        if (ascii[i] == '\0' || str[i] != (unsigned char)ascii[i]) return FALSE;
+    return (ascii[len] == '\0');
+}
+
+/* Return the binding for prefix among the first n bindings in scope, or NULL */
+static const struct xml_binding *lookup_binding(const WCHAR *prefix, int prefix_len, int n)
+{
+    while (--n >= 0)
     {
-        printf("createProcessingInstruction failed (returns %08"PRIxHR")\n", hr);
-        goto CleanReturn;
+        const struct xml_binding *b = &scope.bindings[n];
+        if (b->prefix_len == prefix_len &&
+            (prefix_len == 0 || !memcmp(b->prefix, prefix, prefix_len * sizeof(WCHAR))))
+            return b;
     }
-    hr = IXMLDOMDocument_appendChild(doc, (IXMLDOMNode*)nodePI, NULL);
-    if(hr != S_OK) printf("appending processing instruction as child to doc failed\n");
+    return NULL;
+}
 
-    IXMLDOMProcessingInstruction_Release(nodePI);
+static BOOL bound_to(const WCHAR *prefix, int prefix_len, int n, const char *uri)
+{
+    const struct xml_binding *b = lookup_binding(prefix, prefix_len, n);
+    return span_is(b ? b->uri : NULL, b ? b->uri_len : 0, uri);
+}
 
-    CHK_NULL(soapEnvelope =
-             create_elem_multi(doc, NULL, "SOAP-ENV:Envelope", "xmlns:SOAP-ENV",
-                               "http://schemas.xmlsoap.org/soap/envelope/",
-                               ((how & M_USE_ENVE_CREATE_ELEM) != 0),
-                               ((how & M_SET_ENVE_URI_FULL) != 0), add_nsa1, use_an, a_delay));
+static void raise_rating(enum soap_rating *rating, const char **reason,
+                         enum soap_rating new_rating, const char *new_reason)
+{
+    if (new_rating > *rating)
+    {
+        *rating = new_rating;
+        *reason = new_reason;
+    }
+}
 
-    hr = set_attr(soapEnvelope, "xmlns:xsd", "http://www.w3.org/2001/XMLSchema", use_an);
-    hr = set_attr(soapEnvelope, "xmlns:xsi", "http://www.w3.org/2001/XMLSchema-instance",
-                  use_an);
+/* 64-bit FNV-1a, fed with whole UTF-16 units */
+#define FNV_OFFSET      0xcbf29ce484222325ULL
+#define FNV_PRIME       0x00000100000001b3ULL
 
-    hr = IXMLDOMDocument_appendChild(doc, (IXMLDOMNode*)soapEnvelope, NULL);
-    if(hr != S_OK) printf("appending SOAP envelope as child to doc failed\n");
+static inline ULONGLONG fnv_add(ULONGLONG hash, WCHAR c)
+{
+    return (hash ^ c) * FNV_PRIME;
+}
 
-    CHK_NULL(soapBody =
-             create_elem_multi(doc, soapEnvelope,
-                               ((how & M_SET_BODY_PREFIX) ? "SOAP-ENV:Body"  : "Body"),
-                               ((how & M_SET_BODY_PREFIX) ? "xmlns:SOAP-ENV" : "xmlns"),
-                               "http://schemas.xmlsoap.org/soap/envelope/",
-                               ((how & M_USE_BODY_CREATE_ELEM) != 0),
-                               ((how & M_SET_BODY_URI_FULL) != 0), add_nsa2, use_an, a_delay));
-    CHK_NULL(soapCall =
-             create_elem_multi(doc, soapBody, "Login", "xmlns", "http://www.wso2.org/php/xsd",
-                               ((how & M_USE_LOGIN_CREATE_ELEM) != 0),
-                               ((how & M_SET_LOGIN_URI_FULL) != 0), add_nsa1, use_an, a_delay));
-    CHK_NULL(soapArg1 =
-             create_elem_multi(doc, soapCall, "code", "xmlns", "http://www.wso2.org/php/xsd",
-                               ((how & M_USE_CODE_CREATE_ELEM) != 0),
-                               ((how & M_SET_CODE_URI_FULL) != 0), add_nsa2, use_an, a_delay));
+static ULONGLONG fnv_span(ULONGLONG hash, const WCHAR *str, int len)
+{
+    while (len-- > 0) hash = fnv_add(hash, *str++);
+    return hash;
+}
 
-    hr = IXMLDOMDocument_get_xml(doc, &xml);
-    if(hr == S_OK)
+static inline BOOL is_space(WCHAR c)
+{
+    return (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+}
+
+/* Rate the XML from get_xml against the wanted request (see the top of this file):
+ * Envelope and Body in the SOAP envelope namespace with xsd and xsi bound on Envelope,
+ * and everything below Body (Login, code, ...) in the wso2.org namespace.
+ * This is a one-pass scan of the string, just good enough for what msxml serializes;
+ * the only allocations are the scope arrays, which are reused.
+ * The same pass hashes a namespace-canonicalized form of the document into *canon_hash:
+ * element names as {namespace URI}localname, without any xmlns attributes, and with
+ * <a/> the same as <a></a>.  Other attributes and text are hashed as they are.
+ */
+static enum soap_rating rate_soap_xml(const WCHAR *xml, const char **reason,
+                                      ULONGLONG *canon_hash)
+{
+    static const WCHAR xmlnsW[] = {'x','m','l','n','s'};
+    static const WCHAR xsdW[] = {'x','s','d'}, xsiW[] = {'x','s','i'};
+    enum soap_rating rating = RATE_OPTIM;
+    ULONGLONG hash = FNV_OFFSET;
+    const WCHAR *p = xml;
+
+    *reason = "";
+    scope.nbindings = scope.depth = 0;
+
+    while (*p)
     {
-        // printf("dbgstr(XML(%0x)) = %s\n", how, wine_dbgstr_w(xml));
-        printf("========== Generated XML (how = %4d = 0x%04x): ==========\n%s%s",
-               how, how, wtoascii(xml),
-               "==========================================================\n");
+        const WCHAR *name, *colon = NULL;
+        const struct xml_binding *elem_ns;
+        ULONGLONG attr_hash = FNV_OFFSET;
+        int start, name_len, expect_env;
+        BOOL empty = FALSE;
+
+        if (*p != '<')
+        {
+            hash = fnv_add(hash, *p++);
+            continue;
+        }
+        p++;
+
+        if (*p == '?' || *p == '!')
+        {   /* processing instruction or comment: no namespaces in here */
+            while (*p && *p++ != '>');
+            continue;
+        }
+        if (*p == '/')
+        {   /* end tag: drop the bindings of the element */
+            if (scope.depth > 0)
+                scope.nbindings = scope.elem_start[--scope.depth];
+            hash = fnv_add(hash, '/');
+            while (*p && *p++ != '>');
+            continue;
+        }
+
+        /* start tag */
+        if (scope.depth == scope.depth_size)
+        {
+            scope.depth_size = (scope.depth_size ? 2 * scope.depth_size : 64);
+            scope.elem_start = realloc(scope.elem_start,
+                                       scope.depth_size * sizeof(*scope.elem_start));
+            assert(scope.elem_start != NULL);
+        }
+        start = scope.elem_start[scope.depth] = scope.nbindings;
+
+        for (name = p; *p && !is_space(*p) && *p != '/' && *p != '>'; p++)
+            if (*p == ':' && colon == NULL) colon = p;
+        name_len = p - name;
+
+        for (;;)
+        {
+            const WCHAR *attr, *value;
+            int attr_len;
+            WCHAR quote;
+
+            while (is_space(*p)) p++;
+            if (*p == '/') { empty = TRUE; p++; continue; }
+            if (*p == '>') { p++; break; }
+            if (*p == '\0') break;
+
+            for (attr = p; *p && *p != '=' && !is_space(*p) && *p != '>'; p++);
+            attr_len = p - attr;
+            while (is_space(*p) || *p == '=') p++;
+            if (*p != '"' && *p != '\'') break;
+            quote = *p++;
+            for (value = p; *p && *p != quote; p++);
+            if (*p) p++;
+
+            if (attr_len >= 5 && !memcmp(attr, xmlnsW, sizeof(xmlnsW)) &&
+                (attr_len == 5 || attr[5] == ':'))
+            {
+                struct xml_binding *b;
+                const struct xml_binding *old;
+                const WCHAR *prefix = attr + (attr_len == 5 ? 5 : 6);
+                int prefix_len = attr_len - (attr_len == 5 ? 5 : 6);
+
+                if ((old = lookup_binding(prefix, prefix_len, scope.nbindings)) != NULL &&
+                    old >= scope.bindings + start)
+                {   /* Same prefix declared again on this very element */
+                    raise_rating(&rating, reason, RATE_SILLY, "duplicate xmlns in a row");
+                    continue;
+                }
+                old = lookup_binding(prefix, prefix_len, start);
+                if ((old ? old->uri_len : 0) == p - value - 1 &&
+                    (old == NULL || !memcmp(old->uri, value, old->uri_len * sizeof(WCHAR))))
+                    raise_rating(&rating, reason, RATE_EQUIV, "redundant child binding");
+
+                if (scope.nbindings == scope.bindings_size)
+                {
+                    scope.bindings_size = (scope.bindings_size ? 2 * scope.bindings_size : 64);
+                    scope.bindings = realloc(scope.bindings,
+                                             scope.bindings_size * sizeof(*scope.bindings));
+                    assert(scope.bindings != NULL);
+                }
+                b = &scope.bindings[scope.nbindings++];
+                b->prefix = prefix;
+                b->prefix_len = prefix_len;
+                b->uri = value;
+                b->uri_len = p - value - 1;
+            }
+            else
+            {
+                attr_hash = fnv_add(fnv_span(attr_hash, attr, attr_len), '=');
+                attr_hash = fnv_span(attr_hash, value, p - value - 1);
+            }
+        }
+
+        /* Envelope and Body belong to the envelope namespace, all below to wso2.org */
+        expect_env = (scope.depth < 2);
+        if (colon == NULL ? !bound_to(NULL, 0, scope.nbindings,
+                                      expect_env ? SOAP_ENV_URI : WSO2_URI)
+                          : !bound_to(name, colon - name, scope.nbindings,
+                                      expect_env ? SOAP_ENV_URI : WSO2_URI))
+        {
+            const struct xml_binding *b = (colon == NULL ? lookup_binding(NULL, 0, scope.nbindings)
+                                                         : NULL);
+            raise_rating(&rating, reason, RATE_DIFF,
+                         (colon == NULL && (b == NULL || b->uri_len == 0))
+                         ? "empty namespace" : "wrong namespace");
+        }
+        else if (expect_env && !bound_to(NULL, 0, scope.nbindings, ""))
+            /* Right meaning, but new unprefixed children would silently get a namespace */
+            raise_rating(&rating, reason, RATE_DANG, "default namespace on envelope level");
+
+        if (scope.depth == 0 &&
+            (!bound_to(xsdW, 3, scope.nbindings, XSD_URI) ||
+             !bound_to(xsiW, 3, scope.nbindings, XSI_URI)))
+            raise_rating(&rating, reason, RATE_DIFF, "xsd/xsi not bound on Envelope");
+
+        elem_ns = (colon == NULL ? lookup_binding(NULL, 0, scope.nbindings)
+                                 : lookup_binding(name, colon - name, scope.nbindings));
+        hash = fnv_add(hash, '<');
+        if (elem_ns != NULL)
+            hash = fnv_span(hash, elem_ns->uri, elem_ns->uri_len);
+        hash = fnv_add(hash, '}');
+        hash = (colon == NULL ? fnv_span(hash, name, name_len)
+                              : fnv_span(hash, colon + 1, name + name_len - colon - 1));
+        hash = (hash ^ attr_hash) * FNV_PRIME;
+
+        if (empty)
+        {
+            hash = fnv_add(hash, '/');
+            scope.nbindings = start;
+        }
+        else
+            scope.depth++;
+        if (name_len == 0) break;  /* not XML as we know it */
     }
-    else
-        printf("Getting back the XML failed\n");
-    SysFreeString(xml);
+    *canon_hash = hash;
+    return rating;
+}
 
-CleanReturn:
-    RELEASE_ELEMENT(soapEnvelope);
-    RELEASE_ELEMENT(soapBody);
-    RELEASE_ELEMENT(soapCall);
-    RELEASE_ELEMENT(soapArg1);
-    free_bstrs();
+/***** Deduplication of the generated documents ****************************************/
+
+/* A distinct document (by hash of the raw XML), stored once for the whole sweep */
+struct soap_doc
+{
+    ULONGLONG raw_hash, canon_hash;
+    char *xml;              /* UTF-8; NULL marks a free slot in the table */
+    int *hows;              /* the HOW values producing it, in sweep order */
+    int nhows, hows_size;
+};
+
+static BOOL dedup;          /* -u: store each distinct document once */
+
+/* Open-addressed hash table of the distinct documents, shared by all sweep workers */
+static struct
+{
+    struct soap_doc *docs;
+    int count, size;
+    CRITICAL_SECTION lock;
+} doc_store;
+
+static struct soap_doc *find_doc_slot(struct soap_doc *docs, int size, ULONGLONG raw_hash)
+{
+    int i = (int)(raw_hash & (size - 1));
+
+    while (docs[i].xml != NULL && docs[i].raw_hash != raw_hash)
+        i = (i + 1) & (size - 1);
+    return &docs[i];
 }
 
-int main(int argc, char **argv)
+static void store_doc(ULONGLONG raw_hash, ULONGLONG canon_hash, const WCHAR *xml)
 {
-    int how;
-    IXMLDOMDocument *doc;
-    HRESULT hr;
+    struct soap_doc *doc;
+    int len;
 
-    if (argc != 2 || ((how = atoi(argv[1])) < 0 || how > M_TEST_FLAGS_ALL))
+    EnterCriticalSection(&doc_store.lock);
+    if (2 * (doc_store.count + 1) > doc_store.size)
     {
-        printf("Usage: %s HOW\n  where HOW is an integer 0..%d\n"
-               "  Some interesting values to test:\n"
-               "    2738 2739 1384 1395 1139 5491 5495 1651\n"
-               "    6839 6807 3400 1394 1398 1399 4150\n",
-               argv[0], M_TEST_FLAGS_ALL);
-        return 1;
-    }
+        struct soap_doc *old = doc_store.docs;
+        int i, old_size = doc_store.size;
 
-    hr = CoInitialize( NULL );
+        doc_store.size = (old_size ? 2 * old_size : 256);
+        doc_store.docs = calloc(doc_store.size, sizeof(*doc_store.docs));
+        assert(doc_store.docs != NULL);
+        for (i = 0; i < old_size; i++)
+            if (old[i].xml != NULL)
+                *find_doc_slot(doc_store.docs, doc_store.size, old[i].raw_hash) = old[i];
+        free(old);
+    }
+    doc = find_doc_slot(doc_store.docs, doc_store.size, raw_hash);
+    if (doc->xml == NULL)
+    {
+        len = WideCharToMultiByte(CP_UTF8, 0, xml, -1, NULL, 0, NULL, NULL);
+        doc->xml = malloc(len);
+        assert(doc->xml != NULL);
+        WideCharToMultiByte(CP_UTF8, 0, xml, -1, doc->xml, len, NULL, NULL);
+        doc->raw_hash = raw_hash;
+        doc->canon_hash = canon_hash;
+        doc_store.count++;
+    }
+    LeaveCriticalSection(&doc_store.lock);
+}
 
-    if (hr == S_OK)
-        printf("CoInitialize successful!\n");
-    else
+static void doc_add_how(struct soap_doc *doc, int how)
+{
+    if (doc->nhows == doc->hows_size)
     {
-        printf("Failed to init com\n");
-        return 1;
+        doc->hows_size = (doc->hows_size ? 2 * doc->hows_size : 16);
+        doc->hows = realloc(doc->hows, doc->hows_size * sizeof(*doc->hows));
+        assert(doc->hows != NULL);
     }
+    doc->hows[doc->nhows++] = how;
+}
 
-    hr = CoCreateInstance( &CLSID_DOMDocument, NULL, CLSCTX_INPROC_SERVER,
-                           &IID_IXMLDOMDocument, (void**)&doc );
-    if (hr != S_OK)
+/* Print HOW values compactly, with runs of consecutive values as ranges */
+static void print_how_ranges(const int *hows, int count)
+{
+    int i, j, col = 0;
+
+    for (i = 0; i < count; i = j)
     {
-        printf("IXMLDOMDocument is not available (0x%08"PRIxHR")\n", hr);
+        char range[32];
 
-        CoUninitialize();
-        return 1;
+        for (j = i + 1; j < count && hows[j] == hows[j - 1] + 1; j++);
+        if (j - i > 1)
+            sprintf(range, " %d-%d", hows[i], hows[j - 1]);
+        else
+            sprintf(range, " %d", hows[i]);
+        if (col + strlen(range) > 78)
+        {
+            printf("\n");
+            col = 0;
+        }
+        col += printf("%s", range);
     }
-    printf("DOMDocument successfully created\n");
+    printf("\n");
+}
 
-    test_build_soap(doc, how);
+/* Group the cases by document, in order of first appearance, and print each distinct
+ * document once with the HOW values that produced it.
+ */
+static void print_distinct_docs(const struct soap_case *cases, int count)
+{
+    struct soap_doc **order = malloc((doc_store.count + 1) * sizeof(*order));
+    int *canon_class = malloc((doc_store.count + 1) * sizeof(*canon_class));
+    int *no_xml = malloc((count + 1) * sizeof(*no_xml));
+    int i, j, ndocs = 0, nclasses = 0, nno_xml = 0;
+
+    assert(order != NULL && canon_class != NULL && no_xml != NULL);
+    for (i = 0; i < count; i++)
+    {
+        struct soap_doc *doc;
+
+        if (!cases[i].has_xml)
+        {
+            no_xml[nno_xml++] = cases[i].how;
+            continue;
+        }
+        doc = find_doc_slot(doc_store.docs, doc_store.size, cases[i].raw_hash);
+        if (doc->nhows == 0)
+            order[ndocs++] = doc;
+        doc_add_how(doc, cases[i].how);
+    }
+
+    for (i = 0; i < ndocs; i++)
+    {
+        /* Canonical classes are numbered by first appearance, too */
+        for (j = 0; j < i; j++)
+            if (order[j]->canon_hash == order[i]->canon_hash)
+                break;
+        canon_class[i] = (j < i ? canon_class[j] : ++nclasses);
+
+        printf("========== Document %d (canonical class %d), %d HOW value%s: ==========\n",
+               i + 1, canon_class[i], order[i]->nhows, (order[i]->nhows > 1 ? "s" : ""));
+        print_how_ranges(order[i]->hows, order[i]->nhows);
+        printf("%s==========================================================\n",
+               order[i]->xml);
+    }
+    if (nno_xml > 0)
+    {
+        printf("========== No XML generated, %d HOW value%s: ==========\n",
+               nno_xml, (nno_xml > 1 ? "s" : ""));
+        print_how_ranges(no_xml, nno_xml);
+    }
+    printf("%d cases: %d distinct documents, %d after namespace canonicalization, "
+           "%d without XML\n", count, ndocs, nclasses, nno_xml);
+    free(no_xml);
+    free(canon_class);
+    free(order);
+}
+
+/* Set by the stress test (-P), which only wants the HRESULT trail of its requests */
+static __thread BOOL skip_rating;
+
+/* Rate the current case from its XML (NULL if none was made) and its HRESULT trail */
+static void rate_case(const WCHAR *xml)
+{
+    struct soap_case *c = cur_case;
+
+    if (c == NULL || skip_rating) return;
+    if (xml == NULL)
+    {
+        c->rating = RATE_FAIL;
+        c->reason = "no XML generated";
+    }
+    else
+    {
+        c->rating = rate_soap_xml(xml, &c->reason, &c->canon_hash);
+        c->raw_hash = fnv_span(FNV_OFFSET, xml, lstrlenW(xml));
+        c->has_xml = TRUE;
+        if (dedup)
+            store_doc(c->raw_hash, c->canon_hash, xml);
+    }
+    if (c->first_failure != S_OK)
+        raise_rating(&c->rating, &c->reason, RATE_FAIL, "call failed");
+}
+
+/* Private bytes of the process, sampled by the generator comparison (-w) right after
+ * the XML is made, while everything needed to make it is still alive.
+ */
+static BOOL track_mem;
+static SIZE_T mem_at_output;
+
+/* Size of the Login payload (-n, -d, -v).  Login gets soap_nargs arguments, the first
+ * named "code" and the rest "arg2", "arg3", ...  Each argument is the top of a chain of
+ * soap_depth nested elements (the inner ones named "item"), and the innermost one holds
+ * a text of soap_value_len characters.  All of them are made the way HOW says code is
+ * made.  The defaults give the single empty <code/> of the original request.
+ */
+static int soap_nargs = 1, soap_depth = 1, soap_value_len = 0;
+
+/* The text of the innermost elements, made once per thread */
+static struct cstr soap_value(void)
+{
+    static __thread struct cstr value;
+
+    if (value.a == NULL)
+    {
+        char *buf = malloc(soap_value_len + 1);
+        int i;
+
+        assert(buf != NULL);
+        for (i = 0; i < soap_value_len; i++)
+            buf[i] = '0' + i % 10;
+        buf[soap_value_len] = '\0';
+        value = cstr_interned(buf);
+        free(buf);
+    }
+    return value;
+}
+
+static BOOL add_text(IXMLDOMDocument *doc, IXMLDOMElement *elem, struct cstr text)
+{
+    HRESULT hr;
+    IXMLDOMText *node = NULL;
+
+    op_start();
+    hr = IXMLDOMDocument_createTextNode(doc, text.w, &node);
+    op_done(OP_CREATE_TEXT);
+    CHK_HR("createTextNode (length = %d)\n", (int)strlen(text.a));
+
+    op_start();
+    hr = IXMLDOMElement_appendChild(elem, (IXMLDOMNode*)node, NULL);
+    op_done(OP_APPEND_CHILD);
+    CHK_HR("  appendChild (text node)\n");
+
+CleanReturn:
+    if (node != NULL) IXMLDOMText_Release(node);
+    return (hr == S_OK);
+}
+
+/* Add one argument of Login below parent, with depth - 1 levels of "item" below it
+ * and the text value (if not empty) in the innermost one.  The chain is built in a
+ * loop holding on to the current element only, so any -d fits on the stack.
+ */
+static BOOL add_soap_arg(IXMLDOMDocument *doc, IXMLDOMElement *parent, struct cstr name,
+                         int depth, struct cstr value, int how)
+{
+    IXMLDOMElement *elem = NULL, *outer;
+    BOOL ok = TRUE;
+    int level;
+
+    if (depth < 1) depth = 1;
+    for (level = 0; level < depth; level++)
+    {
+        outer = elem;
+        elem = create_elem_multi(doc, (outer != NULL ? outer : parent),
+                                 (level == 0 ? name : CSTR("item")),
+                                 CSTR("xmlns"), CSTR(WSO2_URI),
+                                 ((how & M_USE_CODE_CREATE_ELEM) != 0),
+                                 ((how & M_SET_CODE_URI_FULL) != 0),
+                                 ((how & M_ADD_NS_ATTRIB_INNER) != 0),
+                                 ((how & M_USE_ATTRIB_NODES) != 0),
+                                 ((how & M_SET_ATTRIB_DELAYED) != 0));
+        RELEASE_ELEMENT(outer);
+        if (elem == NULL) return FALSE;
+    }
+
+    if (value.a[0] != '\0')
+        ok = add_text(doc, elem, value);
+    IXMLDOMElement_Release(elem);
+    return ok;
+}
+
+/* Try building a SOAP request step-by-step like in the Visual Basic example
+ *    http://blogs.msdn.com/b/jpsanders/archive/2007/06/14/how-to-send-soap-call-using-msxml-replace-stk.aspx
+ * to reproduce approximately the SOAP output of BridgeCentral w/ the native dll (winetricks).
+ * Wine's msxml3 currently chokes on the calls made by BridgeCentral, spoiling its SOAP login.
+ * The how argument is interpreted as explained above.
+ * This is split in three: the skeleton that is the same for all requests (processing
+ * instruction, Envelope with xsd and xsi, Body and Login), the arguments of Login, and
+ * the output of the XML, so that the skeleton can also come from a template (-T).
+ */
+static IXMLDOMElement *build_soap_skeleton(IXMLDOMDocument *doc, int how)
+{
+    HRESULT hr;
+    IXMLDOMProcessingInstruction *nodePI = NULL;
+    IXMLDOMElement *soapEnvelope = NULL, *soapBody = NULL, *soapCall = NULL;
+
+    BOOL use_an   = ((how & M_USE_ATTRIB_NODES) != 0);
+    BOOL add_nsa1 = ((how & M_ADD_NS_ATTRIB_TOP) != 0);
+    BOOL add_nsa2 = ((how & M_ADD_NS_ATTRIB_INNER) != 0);
+    BOOL a_delay  = ((how & M_SET_ATTRIB_DELAYED) != 0);
+
+    op_start();
+    hr = IXMLDOMDocument_createProcessingInstruction(doc, CONST_BSTR("xml"),
+                                                     CONST_BSTR("version=\"1.0\""), &nodePI);
+    op_done(OP_CREATE_PI);
+    note_hr(hr);
+    if(hr != S_OK || nodePI == NULL)
+    {
+        out_printf("createProcessingInstruction failed (returns %08"PRIxHR")\n", hr);
+        goto CleanReturn;
+    }
+    op_start();
+    hr = IXMLDOMDocument_appendChild(doc, (IXMLDOMNode*)nodePI, NULL);
+    op_done(OP_APPEND_CHILD);
+    note_hr(hr);
+    if(hr != S_OK) out_printf("appending processing instruction as child to doc failed\n");
+
+    IXMLDOMProcessingInstruction_Release(nodePI);
+
+    CHK_NULL(soapEnvelope =
+             create_elem_multi(doc, NULL, CSTR("SOAP-ENV:Envelope"), CSTR("xmlns:SOAP-ENV"),
+                               CSTR(SOAP_ENV_URI),
+                               ((how & M_USE_ENVE_CREATE_ELEM) != 0),
+                               ((how & M_SET_ENVE_URI_FULL) != 0), add_nsa1, use_an, a_delay));
+
+    hr = set_attr(soapEnvelope, CSTR("xmlns:xsd"), CSTR(XSD_URI), use_an);
+    hr = set_attr(soapEnvelope, CSTR("xmlns:xsi"), CSTR(XSI_URI), use_an);
+
+    op_start();
+    hr = IXMLDOMDocument_appendChild(doc, (IXMLDOMNode*)soapEnvelope, NULL);
+    op_done(OP_APPEND_CHILD);
+    note_hr(hr);
+    if(hr != S_OK) out_printf("appending SOAP envelope as child to doc failed\n");
+
+    CHK_NULL(soapBody =
+             create_elem_multi(doc, soapEnvelope,
+                               ((how & M_SET_BODY_PREFIX) ? CSTR("SOAP-ENV:Body")
+                                                          : CSTR("Body")),
+                               ((how & M_SET_BODY_PREFIX) ? CSTR("xmlns:SOAP-ENV")
+                                                          : CSTR("xmlns")),
+                               CSTR(SOAP_ENV_URI),
+                               ((how & M_USE_BODY_CREATE_ELEM) != 0),
+                               ((how & M_SET_BODY_URI_FULL) != 0), add_nsa2, use_an, a_delay));
+    soapCall = create_elem_multi(doc, soapBody, CSTR("Login"), CSTR("xmlns"), CSTR(WSO2_URI),
+                                 ((how & M_USE_LOGIN_CREATE_ELEM) != 0),
+                                 ((how & M_SET_LOGIN_URI_FULL) != 0), add_nsa1, use_an, a_delay);
+
+CleanReturn:
+    RELEASE_ELEMENT(soapEnvelope);
+    RELEASE_ELEMENT(soapBody);
+    return soapCall;
+}
+
+/* Add the arguments to Login (soapCall), with the given values, or with the values
+ * of the -v option if values is NULL.
+ */
+static BOOL add_soap_args(IXMLDOMDocument *doc, IXMLDOMElement *soapCall, int how,
+                          const struct cstr *values)
+{
+    int i;
+
+    for (i = 0; i < soap_nargs; i++)
+    {
+        char name[16];
+
+        sprintf(name, "arg%d", i + 1);
+        if (!add_soap_arg(doc, soapCall, (i == 0 ? CSTR("code") : cstr_interned(name)),
+                          soap_depth, (values ? values[i] :
+                                       soap_value_len > 0 ? soap_value() : CSTR("")), how))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/* Add the arguments to Login (soapCall) and output and rate the XML */
+static void finish_soap(IXMLDOMDocument *doc, IXMLDOMElement *soapCall, int how)
+{
+    HRESULT hr;
+    BSTR xml = NULL;
+
+    if (!add_soap_args(doc, soapCall, how, NULL))
+        goto CleanReturn;
+
+    if (save_to_stream)
+    {
+        VARIANT dest;
+
+        V_VT(&dest) = VT_UNKNOWN;
+        V_UNKNOWN(&dest) = (IUnknown*)&out_stream;
+        out_printf("========== Generated XML (how = %4d = 0x%04x): ==========\n", how, how);
+        op_start();
+        hr = IXMLDOMDocument_save(doc, dest);
+        op_done(OP_SAVE);
+        note_hr(hr);
+        if(hr == S_OK)
+            out_printf("==========================================================\n");
+        else
+            out_printf("Saving the XML failed (0x%08"PRIxHR")\n", hr);
+        goto CleanReturn;
+    }
+
+    op_start();
+    hr = IXMLDOMDocument_get_xml(doc, &xml);
+    op_done(OP_GET_XML);
+    note_hr(hr);
+    if (track_mem) mem_at_output = private_bytes();
+    if(hr == S_OK)
+    {
+        // printf("dbgstr(XML(%0x)) = %s\n", how, wine_dbgstr_w(xml));
+        out_printf("========== Generated XML (how = %4d = 0x%04x): ==========\n", how, how);
+        out_write_wide(xml, SysStringLen(xml));
+        out_printf("==========================================================\n");
+    }
+    else
+    {
+        out_printf("Getting back the XML failed\n");
+        xml = NULL;
+    }
+
+CleanReturn:
+    if (!save_to_stream)
+        rate_case(xml);
+    SysFreeString(xml);
+}
+
+static void test_build_soap(IXMLDOMDocument *doc, int how)
+{
+    IXMLDOMElement *soapCall;
+    int bstrs_mark = mark_bstrs();
+
+    if ((soapCall = build_soap_skeleton(doc, how)) != NULL)
+    {
+        finish_soap(doc, soapCall, how);
+        IXMLDOMElement_Release(soapCall);
+    }
+    else if (!save_to_stream)
+        rate_case(NULL);
+    release_bstrs(bstrs_mark);
+}
+
+/* A growable list of HOW values to run, in the order given on the command line */
+struct how_list
+{
+    int *hows;
+    int count, size;
+};
+
+static void how_list_add(struct how_list *list, int how)
+{
+    if (list->count == list->size)
+    {
+        list->size = (list->size ? 2 * list->size : 64);
+        list->hows = realloc(list->hows, list->size * sizeof(*list->hows));
+        assert(list->hows != NULL);
+    }
+    list->hows[list->count++] = how;
+}
+
+static BOOL parse_how_arg(struct how_list *list, const char *arg);
+
+/* Read HOW specifications from a file, one or more per line; '#' starts a comment.
+ * Files don't nest (strtok isn't reentrant), so @FILE is not accepted inside a file.
+ * The line buffer grows to hold whole lines, so no token is split at its end.
+ */
+static BOOL parse_how_file(struct how_list *list, const char *filename)
+{
+    char *line, *token;
+    size_t size = 256, len;
+    BOOL ok = TRUE;
+    FILE *f = fopen(filename, "r");
+
+    if (f == NULL)
+    {
+        printf("Cannot open HOW file %s\n", filename);
+        return FALSE;
+    }
+    line = malloc(size);
+    assert(line != NULL);
+    while (ok && fgets(line, size, f) != NULL)
+    {
+        len = strlen(line);
+        while (len > 0 && line[len - 1] != '\n' && !feof(f))
+        {
+            size *= 2;
+            line = realloc(line, size);
+            assert(line != NULL);
+            if (fgets(line + len, size - len, f) == NULL) break;
+            len += strlen(line + len);
+        }
+        line[strcspn(line, "#")] = '\0';
+        for (token = strtok(line, " \t\r\n,"); ok && token != NULL;
+             token = strtok(NULL, " \t\r\n,"))
+            ok = (token[0] != '@' && parse_how_arg(list, token));
+    }
+    free(line);
+    fclose(f);
+    return ok;
+}
+
+/* Parse one HOW argument: a single value N, an inclusive range LO-HI, or @FILE.
+ * Values may be given in decimal or, with a 0x prefix, in hex.
+ */
+static BOOL parse_how_arg(struct how_list *list, const char *arg)
+{
+    char *end;
+    long lo, hi;
+
+    if (arg[0] == '@')
+        return parse_how_file(list, arg + 1);
+
+    lo = hi = strtol(arg, &end, 0);
+    if (end != arg && *end == '-')
+    {
+        const char *start = end + 1;
+        hi = strtol(start, &end, 0);
+        if (end == start) return FALSE;
+    }
+    if (end == arg || *end != '\0' || lo < 0 || hi > M_TEST_FLAGS_ALL || lo > hi)
+    {
+        printf("Invalid HOW value or range \"%s\"\n", arg);
+        return FALSE;
+    }
+    for (; lo <= hi; lo++)
+        how_list_add(list, lo);
+    return TRUE;
+}
+
+/* The DOMDocument classes of the msxml versions; -D picks the one used for the cases */
+static const struct doc_version
+{
+    const char *name;
+    const CLSID *clsid;
+} doc_versions[] =
+{
+    { "DOMDocument",   &CLSID_DOMDocument },
+    { "DOMDocument26", &CLSID_DOMDocument26 },
+    { "DOMDocument30", &CLSID_DOMDocument30 },
+    { "DOMDocument40", &CLSID_DOMDocument40 },
+    { "DOMDocument60", &CLSID_DOMDocument60 },
+};
+
+#define NB_DOC_VERSIONS (sizeof(doc_versions) / sizeof(doc_versions[0]))
+
+static const struct doc_version *doc_version = &doc_versions[0];
+
+static HRESULT create_doc(IXMLDOMDocument **doc)
+{
+    return CoCreateInstance( doc_version->clsid, NULL, CLSCTX_INPROC_SERVER,
+                             &IID_IXMLDOMDocument, (void**)doc );
+}
+
+/* Set the document properties like BridgeCentral does for its request */
+static void configure_doc(IXMLDOMDocument *doc)
+{
+    IXMLDOMDocument_put_preserveWhiteSpace(doc, VARIANT_FALSE);
+    IXMLDOMDocument_put_resolveExternals(doc, VARIANT_FALSE);
+    IXMLDOMDocument_put_validateOnParse(doc, VARIANT_FALSE);
+    IXMLDOMDocument_put_async(doc, VARIANT_FALSE);
+}
+
+/***** Reuse of documents *************************************************************/
+
+/* How a used document is made empty again for the next case (-R) */
+enum doc_reset
+{
+    RESET_NONE,         /* don't reuse documents, create a fresh one per case */
+    RESET_REMOVE,       /* removeChild of every child of the document */
+    RESET_LOADXML       /* loadXML of an empty string, which fails but empties it */
+};
+
+static enum doc_reset doc_reset;
+
+static const char * const reset_names[] = { "none", "remove", "loadxml" };
+
+/* Documents are apartment threaded, so each thread keeps its own spare document.
+ * A case takes one document and gives it back before the next, so one is enough.
+ */
+static __thread IXMLDOMDocument *spare_doc;
+
+static HRESULT reset_doc(IXMLDOMDocument *doc, enum doc_reset how)
+{
+    IXMLDOMNode *child;
+    VARIANT_BOOL loaded;
+    HRESULT hr;
+
+    if (how == RESET_LOADXML)
+        IXMLDOMDocument_loadXML(doc, CONST_BSTR(""), &loaded);
+
+    while ((hr = IXMLDOMDocument_get_firstChild(doc, &child)) == S_OK)
+    {
+        /* Not expected after loadXML, but then we fall back to removing the rest */
+        hr = IXMLDOMDocument_removeChild(doc, child, NULL);
+        IXMLDOMNode_Release(child);
+        if (hr != S_OK) return hr;
+    }
+    return (hr == S_FALSE ? S_OK : hr);
+}
+
+/* Get an empty, configured document: the spare one if there is one, otherwise new */
+static HRESULT get_doc(IXMLDOMDocument **doc)
+{
+    HRESULT hr;
+
+    if (spare_doc != NULL)
+    {
+        *doc = spare_doc;
+        spare_doc = NULL;
+        return S_OK;
+    }
+    op_start();
+    hr = create_doc(doc);
+    op_done(OP_CREATE_DOC);
+    if (hr != S_OK) return hr;
+
+    op_start();
+    configure_doc(*doc);
+    op_done(OP_CONFIGURE_DOC);
+    return S_OK;
+}
+
+/* Give a document back: reset it as the spare one when reusing, otherwise release it */
+static void put_doc(IXMLDOMDocument *doc)
+{
+    HRESULT hr;
+
+    if (doc_reset != RESET_NONE && spare_doc == NULL)
+    {
+        op_start();
+        hr = reset_doc(doc, doc_reset);
+        op_done(OP_RESET_DOC);
+        if (hr == S_OK)
+        {
+            spare_doc = doc;
+            return;
+        }
+    }
+    IXMLDOMDocument_Release(doc);
+}
+
+static void free_spare_doc(void)
+{
+    if (spare_doc != NULL)
+        IXMLDOMDocument_Release(spare_doc);
+    spare_doc = NULL;
+}
+
+/***** Templates of the request skeleton *********************************************/
+
+/* With -T, the skeleton of the request (see build_soap_skeleton) is built only once per
+ * thread for each combination of the HOW flags it depends on.  A case then gets a deep
+ * cloneNode of that template document and only adds the arguments of Login.
+ * If the skeleton can't be built, or the clone fails, the case is built from scratch;
+ * a failed skeleton is remembered, so it is tried only once per thread.  The calls of
+ * the skeleton are logged by the case that builds it; the others get a summary line.
+ */
+#define M_SKELETON_FLAGS (M_TEST_FLAGS_ALL & ~(M_SET_CODE_URI_FULL | M_USE_CODE_CREATE_ELEM))
+
+struct soap_template
+{
+    IXMLDOMDocument *doc;
+    BOOL failed;            /* the skeleton couldn't be built, don't try again */
+    int calls;              /* DOM calls of the skeleton, and the first of them failing; */
+    HRESULT first_failure;  /* both passed on to every case made from it */
+};
+
+static BOOL use_templates;                      /* -T */
+static __thread struct soap_template *templates; /* indexed by how & M_SKELETON_FLAGS */
+
+static struct soap_template *get_template(int how)
+{
+    struct soap_template *t;
+    struct soap_case *c = cur_case, skeleton_case;
+    IXMLDOMElement *soapCall;
+    int bstrs_mark;
+
+    if (templates == NULL)
+    {
+        templates = calloc(M_SKELETON_FLAGS + 1, sizeof(*templates));
+        assert(templates != NULL);
+    }
+    t = &templates[how & M_SKELETON_FLAGS];
+    if (t->doc != NULL) return t;
+    if (t->failed) return NULL;
+
+    if (get_doc(&t->doc) != S_OK)
+    {
+        t->doc = NULL;
+        return NULL;
+    }
+    /* Only the calls made for the skeleton go in its HRESULT trail */
+    memset(&skeleton_case, 0, sizeof(skeleton_case));
+    cur_case = &skeleton_case;
+    bstrs_mark = mark_bstrs();
+    soapCall = build_soap_skeleton(t->doc, how);
+    release_bstrs(bstrs_mark);
+    cur_case = c;
+
+    if (soapCall == NULL)
+    {
+        IXMLDOMDocument_Release(t->doc);
+        t->doc = NULL;
+        t->failed = TRUE;
+        return NULL;
+    }
+    IXMLDOMElement_Release(soapCall);
+    t->calls = skeleton_case.calls;
+    t->first_failure = skeleton_case.first_failure;
+    return t;
+}
+
+/* Make a new document from the skeleton of a request; returns its Login element, or NULL */
+static IXMLDOMElement *clone_skeleton(IXMLDOMDocument *skeleton, IXMLDOMDocument **clone)
+{
+    IXMLDOMNode *node, *body, *login;
+    IXMLDOMElement *envelope, *soapCall = NULL;
+    HRESULT hr;
+
+    op_start();
+    hr = IXMLDOMDocument_cloneNode(skeleton, VARIANT_TRUE, &node);
+    op_done(OP_CLONE_TEMPLATE);
+    if (hr != S_OK) return NULL;
+    hr = IXMLDOMNode_QueryInterface(node, &IID_IXMLDOMDocument, (void**)clone);
+    IXMLDOMNode_Release(node);
+    if (hr != S_OK) return NULL;
+
+    /* Login is the only child of Body, which is the only child of Envelope */
+    if (IXMLDOMDocument_get_documentElement(*clone, &envelope) == S_OK)
+    {
+        if (IXMLDOMElement_get_lastChild(envelope, &body) == S_OK)
+        {
+            if (IXMLDOMNode_get_lastChild(body, &login) == S_OK)
+            {
+                IXMLDOMNode_QueryInterface(login, &IID_IXMLDOMElement, (void**)&soapCall);
+                IXMLDOMNode_Release(login);
+            }
+            IXMLDOMNode_Release(body);
+        }
+        IXMLDOMElement_Release(envelope);
+    }
+    if (soapCall == NULL)
+    {
+        IXMLDOMDocument_Release(*clone);
+        return NULL;
+    }
+    configure_doc(*clone);
+    return soapCall;
+}
+
+/* Make a new document from the template for how; returns its Login element, or NULL */
+static IXMLDOMElement *clone_template(int how, IXMLDOMDocument **clone)
+{
+    struct soap_template *t = get_template(how);
+    struct soap_case *c = cur_case;
+    IXMLDOMElement *soapCall;
+
+    if (t == NULL || (soapCall = clone_skeleton(t->doc, clone)) == NULL)
+        return NULL;
+    if (c != NULL)
+    {
+        c->calls += t->calls;
+        if (c->first_failure == S_OK)
+            c->first_failure = t->first_failure;
+    }
+    if (!trace_calls)
+        out_printf("%-5s <-- skeleton from the template (%d calls)\n",
+                   hr_status(t->first_failure), t->calls);
+    return soapCall;
+}
+
+static void free_templates(void)
+{
+    int i;
+
+    if (templates == NULL) return;
+    for (i = 0; i <= M_SKELETON_FLAGS; i++)
+        if (templates[i].doc != NULL)
+            IXMLDOMDocument_Release(templates[i].doc);
+    free(templates);
+    templates = NULL;
+}
+
+/***** Allocation profiler *************************************************************/
+
+/* With -M an IMallocSpy (CoRegisterMallocSpy) counts the allocations going through
+ * IMalloc, i.e. CoTaskMemAlloc & co., per case and per timed DOM call, and keeps the
+ * blocks allocated during a case to report those still live at its end.  Allocations
+ * msxml3 makes from its own heap aren't seen, so the growth of the private bytes is
+ * shown too.  After each case the references left on its document are counted as well;
+ * only those of the document, not of the elements and attributes the DOM calls return.
+ * The strings of the harness are interned before the case, and the case makes none in
+ * the BSTR arena, so what is counted is msxml3's own.  The spy isn't thread safe, so
+ * -M needs -j 1.
+ */
+struct live_block
+{
+    void *ptr;              /* NULL: free slot, LIVE_DELETED: removed */
+    SIZE_T size;
+};
+
+#define LIVE_DELETED ((void*)1)
+
+static struct
+{
+    struct live_block *blocks;
+    int count, used, size;  /* live blocks, slots not free, all slots */
+    struct alloc_stats case_allocs;
+    SIZE_T alloc_request, realloc_request;
+    void *realloc_old;
+    SIZE_T case_start_bytes;
+} spy;
+
+static struct live_block *find_block(struct live_block *blocks, int size, void *ptr)
+{
+    int i = (int)(((UINT_PTR)ptr >> 3) & (size - 1));
+
+    while (blocks[i].ptr != NULL && blocks[i].ptr != ptr)
+        i = (i + 1) & (size - 1);
+    return &blocks[i];
+}
+
+static void spy_allocated(void *ptr, SIZE_T size)
+{
+    struct live_block *block;
+
+    spy.case_allocs.allocs++;
+    spy.case_allocs.bytes += size;
+    pending_allocs.allocs++;
+    pending_allocs.bytes += size;
+
+    if (2 * (spy.used + 1) > spy.size)
+    {
+        struct live_block *old = spy.blocks;
+        int i, old_size = spy.size;
+
+        spy.size = (old_size ? 2 * old_size : 1024);
+        spy.blocks = calloc(spy.size, sizeof(*spy.blocks));
+        assert(spy.blocks != NULL);
+        for (i = 0; i < old_size; i++)
+            if (old[i].ptr != NULL && old[i].ptr != LIVE_DELETED)
+                *find_block(spy.blocks, spy.size, old[i].ptr) = old[i];
+        spy.used = spy.count;
+        free(old);
+    }
+    block = find_block(spy.blocks, spy.size, ptr);
+    block->ptr = ptr;
+    block->size = size;
+    spy.count++;
+    spy.used++;
+}
+
+static void spy_freed(void *ptr)
+{
+    struct live_block *block;
+
+    spy.case_allocs.frees++;
+    pending_allocs.frees++;
+    if (spy.size == 0) return;
+    block = find_block(spy.blocks, spy.size, ptr);
+    if (block->ptr == ptr)
+    {
+        block->ptr = LIVE_DELETED;
+        spy.count--;
+    }
+}
+
+static HRESULT WINAPI spy_QueryInterface(IMallocSpy *iface, REFIID riid, void **obj)
+{
+    if (IsEqualIID(riid, &IID_IUnknown) || IsEqualIID(riid, &IID_IMallocSpy))
+    {
+        *obj = iface;
+        return S_OK;
+    }
+    *obj = NULL;
+    return E_NOINTERFACE;
+}
+
+static ULONG WINAPI spy_AddRef(IMallocSpy *iface)
+{
+    return 2;
+}
+
+static ULONG WINAPI spy_Release(IMallocSpy *iface)
+{
+    return 1;
+}
+
+static SIZE_T WINAPI spy_PreAlloc(IMallocSpy *iface, SIZE_T request)
+{
+    spy.alloc_request = request;
+    return request;
+}
+
+static void * WINAPI spy_PostAlloc(IMallocSpy *iface, void *actual)
+{
+    if (actual != NULL) spy_allocated(actual, spy.alloc_request);
+    return actual;
+}
+
+static void * WINAPI spy_PreFree(IMallocSpy *iface, void *request, BOOL spyed)
+{
+    if (request != NULL) spy_freed(request);
+    return request;
+}
+
+static void WINAPI spy_PostFree(IMallocSpy *iface, BOOL spyed)
+{
+}
+
+static SIZE_T WINAPI spy_PreRealloc(IMallocSpy *iface, void *request, SIZE_T size,
+                                    void **new_request, BOOL spyed)
+{
+    spy.realloc_old = request;
+    spy.realloc_request = size;
+    *new_request = request;
+    return size;
+}
+
+/* A realloc counts as a free of the old block and an allocation of the new one */
+static void * WINAPI spy_PostRealloc(IMallocSpy *iface, void *actual, BOOL spyed)
+{
+    if (spy.realloc_old != NULL && (actual != NULL || spy.realloc_request == 0))
+        spy_freed(spy.realloc_old);
+    if (actual != NULL)
+        spy_allocated(actual, spy.realloc_request);
+    return actual;
+}
+
+static void * WINAPI spy_PreGetSize(IMallocSpy *iface, void *request, BOOL spyed)
+{
+    return request;
+}
+
+static SIZE_T WINAPI spy_PostGetSize(IMallocSpy *iface, SIZE_T actual, BOOL spyed)
+{
+    return actual;
+}
+
+static void * WINAPI spy_PreDidAlloc(IMallocSpy *iface, void *request, BOOL spyed)
+{
+    return request;
+}
+
+static int WINAPI spy_PostDidAlloc(IMallocSpy *iface, void *request, BOOL spyed, int actual)
+{
+    return actual;
+}
+
+static void WINAPI spy_PreHeapMinimize(IMallocSpy *iface)
+{
+}
+
+static void WINAPI spy_PostHeapMinimize(IMallocSpy *iface)
+{
+}
+
+static const IMallocSpyVtbl malloc_spy_vtbl =
+{
+    spy_QueryInterface,
+    spy_AddRef,
+    spy_Release,
+    spy_PreAlloc,
+    spy_PostAlloc,
+    spy_PreFree,
+    spy_PostFree,
+    spy_PreRealloc,
+    spy_PostRealloc,
+    spy_PreGetSize,
+    spy_PostGetSize,
+    spy_PreDidAlloc,
+    spy_PostDidAlloc,
+    spy_PreHeapMinimize,
+    spy_PostHeapMinimize
+};
+
+static IMallocSpy malloc_spy = { &malloc_spy_vtbl };
+
+/* Intern the argument names and the value (-n, -v) ahead of a profiled case, so their
+ * SysAllocString isn't counted as an allocation of the case.
+ */
+static void intern_soap_strings(void)
+{
+    char name[16];
+    int i;
+
+    if (soap_value_len > 0) soap_value();
+    for (i = 1; i < soap_nargs; i++)
+    {
+        sprintf(name, "arg%d", i + 1);
+        cstr_interned(name);
+    }
+}
+
+/* The number of references to obj, probed with an AddRef and a Release */
+static LONG refs_held(IUnknown *obj)
+{
+    IUnknown_AddRef(obj);
+    return IUnknown_Release(obj);
+}
+
+static void alloc_case_start(struct soap_case *c)
+{
+    memset(&spy.case_allocs, 0, sizeof(spy.case_allocs));
+    if (spy.size != 0)
+        memset(spy.blocks, 0, spy.size * sizeof(*spy.blocks));
+    spy.count = spy.used = 0;
+    spy.case_start_bytes = private_bytes();
+}
+
+static void alloc_case_done(struct soap_case *c)
+{
+    int i;
+
+    c->allocs = spy.case_allocs;
+    c->live = spy.count;
+    c->live_bytes = 0;
+    for (i = 0; i < spy.size; i++)
+        if (spy.blocks[i].ptr != NULL && spy.blocks[i].ptr != LIVE_DELETED)
+            c->live_bytes += spy.blocks[i].size;
+    c->private_kb = (LONG)(((LONGLONG)private_bytes() - (LONGLONG)spy.case_start_bytes) / 1024);
+}
+
+static void print_alloc_profile(const struct soap_case *cases, int count)
+{
+    struct alloc_stats total;
+    int i, live = 0;
+    LONG doc_refs = 0;
+
+    printf("========== Allocations through IMalloc, per case ==========\n");
+    printf("%6s %8s %8s %10s %6s %10s %8s %10s\n", "how", "allocs", "frees", "bytes",
+           "live", "live bytes", "doc refs", "private KB");
+    memset(&total, 0, sizeof(total));
+    for (i = 0; i < count; i++)
+    {
+        const struct soap_case *c = &cases[i];
+
+        printf("%6d %8d %8d %10lu %6d %10lu %8ld %10ld\n", c->how, c->allocs.allocs,
+               c->allocs.frees, (unsigned long)c->allocs.bytes, c->live,
+               (unsigned long)c->live_bytes, (long)c->doc_refs, (long)c->private_kb);
+        total.allocs += c->allocs.allocs;
+        total.frees += c->allocs.frees;
+        total.bytes += c->allocs.bytes;
+        live += c->live;
+        doc_refs += c->doc_refs;
+    }
+    printf("Total: %d allocations of %lu bytes, %d frees, %d blocks and %ld document "
+           "references left\n", total.allocs, (unsigned long)total.bytes, total.frees, live,
+           (long)doc_refs);
+
+    printf("========== Allocations through IMalloc, per DOM call ==========\n");
+    printf("%-28s %8s %8s %8s %10s %10s\n", "call", "calls", "allocs", "frees", "bytes",
+           "bytes/call");
+    for (i = 0; i < OP_COUNT; i++)
+        if (op_allocs[i].calls != 0)
+            printf("%-28s %8d %8d %8d %10lu %10.1f\n", op_names[i], op_allocs[i].calls,
+                   op_allocs[i].allocs, op_allocs[i].frees, (unsigned long)op_allocs[i].bytes,
+                   (double)op_allocs[i].bytes / op_allocs[i].calls);
+}
+
+/* Run a single HOW case on an empty document, recording its wall time and rating */
+static void run_case(struct soap_case *c)
+{
+    IXMLDOMDocument *doc;
+    IXMLDOMElement *soapCall;
+    int bstrs_mark = mark_bstrs();
+    double start;
+
+    cur_case = c;
+    if (trace_calls) trace_start();
+    if (profile_allocs)
+    {
+        intern_soap_strings();
+        alloc_case_start(c);
+    }
+    start = now_ms();
+    if (use_templates && (soapCall = clone_template(c->how, &doc)) != NULL)
+    {
+        finish_soap(doc, soapCall, c->how);
+        IXMLDOMElement_Release(soapCall);
+        if (profile_allocs) c->doc_refs = refs_held((IUnknown*)doc) - 1;
+        IXMLDOMDocument_Release(doc);
+        c->ms = now_ms() - start;
+    }
+    else if (get_doc(&doc) != S_OK)
+        c->ms = -1.0;
+    else
+    {
+        test_build_soap(doc, c->how);
+        if (profile_allocs) c->doc_refs = refs_held((IUnknown*)doc) - 1;
+        put_doc(doc);
+        c->ms = now_ms() - start;
+    }
+    if (profile_allocs) alloc_case_done(c);
+    release_bstrs(bstrs_mark);
+    if (trace_calls && c->first_failure != S_OK)
+        trace_print(c->how);
+    cur_case = NULL;
+}
+
+/* With -e only one case per class of equivalent HOW values (see canonical_how) is run,
+ * and its results are copied to the others.  reduce_cases() makes the cases to run, in
+ * the order of their first member, and sets rep[i] to the index of the one of cases[i];
+ * it returns their number.  expand_cases() copies the results of the first done of them
+ * back, returning the number of cases so completed.
+ */
+static int reduce_cases(const struct soap_case *cases, int count, struct soap_case **reps,
+                        int *rep)
+{
+    int *index = malloc((M_TEST_FLAGS_ALL + 1) * sizeof(*index));
+    int i, n = 0;
+
+    *reps = calloc(count, sizeof(**reps));
+    assert(index != NULL && *reps != NULL);
+    for (i = 0; i <= M_TEST_FLAGS_ALL; i++)
+        index[i] = -1;
+    for (i = 0; i < count; i++)
+    {
+        int how = canonical_how(cases[i].how);
+
+        if (index[how] < 0)
+        {
+            index[how] = n;
+            (*reps)[n++].how = how;
+        }
+        rep[i] = index[how];
+    }
+    free(index);
+    printf("%d cases reduced to %d representatives of equivalent HOW values\n", count, n);
+    return n;
+}
+
+static int expand_cases(struct soap_case *cases, int count, const struct soap_case *reps,
+                        int done, const int *rep)
+{
+    int i;
+
+    for (i = 0; i < count && rep[i] < done; i++)
+    {
+        int how = cases[i].how;
+
+        cases[i] = reps[rep[i]];
+        cases[i].how = how;
+        cases[i].out.data = NULL;
+    }
+    return i;
+}
+
+/* Print the ratings as a table in the format of doc/tst-msxml_make_soap_results.txt */
+static void print_ratings(const struct soap_case *cases, int count)
+{
+    int i, totals[RATE_FAIL + 1] = { 0 };
+
+    printf("Flags\tRating\tReason\n");
+    for (i = 0; i < count; i++)
+    {
+        printf("%d\t%s\t%s\n", cases[i].how, rating_name(cases[i].rating), cases[i].reason);
+        totals[cases[i].rating]++;
+    }
+    printf("Totals:");
+    for (i = RATE_OPTIM; i <= RATE_FAIL; i++)
+        if (totals[i] != 0)
+            printf("  %s %d", rating_name(i), totals[i]);
+    printf("\n");
+}
+
+/* The parallel sweep gives each worker a contiguous shard of the case array.
+ * A shard is the half-open index range [next, end), packed into one 64-bit value
+ * (next in the low half) so that it can be updated with a single compare-exchange.
+ * The owner takes cases from the front; a worker whose shard has run dry steals the
+ * back half of the fullest other shard, so a shard full of slow (failing) cases
+ * doesn't keep the others waiting.
+ */
+#define SHARD_PACK(next, end)   (((LONGLONG)(end) << 32) | (ULONG)(next))
+#define SHARD_NEXT(range)       ((int)(ULONG)(range))
+#define SHARD_END(range)        ((int)((range) >> 32))
+
+struct sweep
+{
+    struct soap_case *cases;
+    LONGLONG volatile *shards;
+    int nworkers;
+    LONG failed_workers;
+};
+
+struct sweep_worker
+{
+    struct sweep *sweep;
+    int id;
+};
+
+static LONGLONG shard_get(LONGLONG volatile *shard)
+{
+    return InterlockedCompareExchange64(shard, 0, 0);  /* atomic read, also on i386 */
+}
+
+static int shard_pop(LONGLONG volatile *shard)
+{
+    LONGLONG range;
+
+    do {
+        range = shard_get(shard);
+        if (SHARD_NEXT(range) >= SHARD_END(range)) return -1;
+    } while (InterlockedCompareExchange64(shard, SHARD_PACK(SHARD_NEXT(range) + 1,
+                                                           SHARD_END(range)),
+                                          range) != range);
+    return SHARD_NEXT(range);
+}
+
+/* Steal the back half of the fullest shard into our own (empty) one and return the
+ * first stolen case, or -1 when all shards are empty.
+ */
+static int shard_steal(struct sweep *sweep, int id)
+{
+    for (;;)
+    {
+        LONGLONG range, best_range = 0;
+        int i, left, take, best = -1, best_left = 0;
+
+        for (i = 0; i < sweep->nworkers; i++)
+        {
+            if (i == id) continue;
+            range = shard_get(&sweep->shards[i]);
+            left = SHARD_END(range) - SHARD_NEXT(range);
+            if (left > best_left)
+            {
+                best = i;
+                best_left = left;
+                best_range = range;
+            }
+        }
+        if (best < 0) return -1;
+
+        take = (best_left + 1) / 2;
+        if (InterlockedCompareExchange64(&sweep->shards[best],
+                                         SHARD_PACK(SHARD_NEXT(best_range),
+                                                    SHARD_END(best_range) - take),
+                                         best_range) != best_range)
+            continue;  /* Lost the race against the owner or another thief, retry */
+
+        /* Only we refill our own shard, and nobody steals from an empty one */
+        InterlockedCompareExchange64(&sweep->shards[id],
+                                     SHARD_PACK(SHARD_END(best_range) - take + 1,
+                                                SHARD_END(best_range)),
+                                     shard_get(&sweep->shards[id]));
+        return SHARD_END(best_range) - take;
+    }
+}
+
+static DWORD WINAPI sweep_worker_proc(void *arg)
+{
+    struct sweep_worker *worker = arg;
+    struct sweep *sweep = worker->sweep;
+    int i;
+
+    /* Every worker has its own apartment and creates its own documents */
+    if (CoInitialize(NULL) != S_OK)
+    {
+        InterlockedIncrement(&sweep->failed_workers);
+        return 1;
+    }
+    while ((i = shard_pop(&sweep->shards[worker->id])) >= 0 ||
+           (i = shard_steal(sweep, worker->id)) >= 0)
+    {
+        cur_out = &sweep->cases[i].out;
+        run_case(&sweep->cases[i]);
+        cur_out = NULL;
+    }
+    free_templates();
+    free_spare_doc();
+    free_bstrs();
+    free_interned_bstrs();
+    CoUninitialize();
+    return 0;
+}
+
+/* Run all cases on nworkers threads, collecting the output of each case */
+static BOOL run_sweep_parallel(struct soap_case *cases, int count, int nworkers)
+{
+    struct sweep sweep;
+    struct sweep_worker *workers;
+    HANDLE *threads;
+    int i, started;
+
+    sweep.cases = cases;
+    sweep.nworkers = nworkers;
+    sweep.failed_workers = 0;
+    sweep.shards = malloc(nworkers * sizeof(*sweep.shards));
+    workers = malloc(nworkers * sizeof(*workers));
+    threads = malloc(nworkers * sizeof(*threads));
+    assert(sweep.shards != NULL && workers != NULL && threads != NULL);
+
+    for (i = 0; i < nworkers; i++)
+    {
+        sweep.shards[i] = SHARD_PACK((LONGLONG)count * i / nworkers,
+                                     (LONGLONG)count * (i + 1) / nworkers);
+        workers[i].sweep = &sweep;
+        workers[i].id = i;
+    }
+    for (started = 0; started < nworkers; started++)
+    {
+        threads[started] = CreateThread(NULL, 0, sweep_worker_proc, &workers[started], 0, NULL);
+        if (threads[started] == NULL) break;
+    }
+    /* Cases of workers that didn't start get stolen by the others */
+    for (i = 0; i < started; i++)
+    {
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+    }
+    if (started == 0 || sweep.failed_workers == started)
+        printf("No sweep worker could be started\n");
+
+    free(threads);
+    free(workers);
+    free((void*)sweep.shards);
+    return (started > 0 && sweep.failed_workers < started);
+}
+
+static int number_of_cpus(void)
+{
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    return (info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1);
+}
+
+/* Run all cases, serially or on nworkers threads, and print their output in HOW order.
+ * Returns the number of cases run before the first one that couldn't get a document.
+ */
+static int run_sweep(struct soap_case *cases, int count, int nworkers, BOOL timing)
+{
+    double start = now_ms(), total = 0.0;
+    int i, done;
+
+    if (nworkers > 1 && !run_sweep_parallel(cases, count, nworkers))
+        return 0;
+
+    for (i = 0; i < count; i++)
+    {
+        struct soap_case *c = &cases[i];
+
+        if (nworkers > 1)
+        {
+            fwrite(c->out.data, 1, c->out.len, out_file);
+            free(c->out.data);
+            c->out.data = NULL;
+        }
+        else
+            run_case(c);
+
+        if (c->ms < 0.0)
+        {
+            printf("Creating DOMDocument failed for how = %d\n", c->how);
+            break;
+        }
+        total += c->ms;
+        if (timing)
+            printf("---------- how = %4d: %10.3f ms ----------\n", c->how, c->ms);
+    }
+    if (timing)
+        printf("Ran %d cases in %.3f ms (%.3f ms summed over cases, %d thread%s)\n",
+               i, now_ms() - start, total, nworkers, (nworkers > 1 ? "s" : ""));
+
+    for (done = i; i < count; i++)
+        free(cases[i].out.data);
+    return done;
+}
+
+/***** Result cache ******************************************************************/
+
+/* Most cases give the same result as the last time they ran on the same msxml3.
+ * With -c FILE the results are kept in FILE under a key identifying msxml3.dll, this
+ * program and the options changing the generated XML; cases already stored under the
+ * current key aren't run again but reported from FILE, without their XML.
+ * With -C only the cases are run whose result on the previous msxml3 (the last key
+ * stored before the current one) differs from their result on an earlier one, so that
+ * bisecting a regression reruns just the cases it changed.
+ * FILE is plain text, one result per line, and only ever appended to.
+ */
+struct cached_result
+{
+    ULONGLONG key;
+    int how;
+    enum soap_rating rating;
+    HRESULT first_failure;
+    int calls;
+    BOOL has_xml;
+    ULONGLONG raw_hash, canon_hash;
+    char *reason;
+};
+
+static struct
+{
+    struct cached_result *results;      /* sorted by key and HOW once loaded */
+    int count, size;
+    ULONGLONG *keys;                    /* in the order they were first stored */
+    int nkeys;
+} result_cache;
+
+static ULONGLONG hash_bytes(ULONGLONG hash, const void *data, size_t len)
+{
+    const BYTE *p = data;
+
+    while (len--) hash = (hash ^ *p++) * FNV_PRIME;
+    return hash;
+}
+
+static BOOL hash_file(ULONGLONG *hash, const char *path)
+{
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+    BYTE buf[65536];
+    DWORD len;
+
+    if (file == INVALID_HANDLE_VALUE)
+        return FALSE;
+    while (ReadFile(file, buf, sizeof(buf), &len, NULL) && len > 0)
+        *hash = hash_bytes(*hash, buf, len);
+    CloseHandle(file);
+    return TRUE;
+}
+
+/* The key of the results of this run, described in desc, or 0 if msxml3.dll can't be
+ * identified.  A builtin msxml3 may be a placeholder file, so the Wine build is part of
+ * the key too.
+ */
+static ULONGLONG cache_key(char *desc, int size)
+{
+    const char *(CDECL *get_build_id)(void);
+    char dll[MAX_PATH], exe[MAX_PATH], params[128];
+    HMODULE msxml = GetModuleHandleA("msxml3.dll");
+    const char *build = "native";
+    ULONGLONG key = FNV_OFFSET;
+
+    if (msxml == NULL || !GetModuleFileNameA(msxml, dll, sizeof(dll)) || !hash_file(&key, dll))
+        return 0;
+    get_build_id = (void*)GetProcAddress(GetModuleHandleA("ntdll.dll"), "wine_get_build_id");
+    if (get_build_id != NULL)
+        build = get_build_id();
+    if (!GetModuleFileNameA(NULL, exe, sizeof(exe)) || !hash_file(&key, exe))
+        strcpy(exe, "built " __DATE__ " " __TIME__);
+    sprintf(params, "-n %d -d %d -v %d -R %s%s -D %s", soap_nargs, soap_depth, soap_value_len,
+            reset_names[doc_reset], (use_templates ? " -T" : ""), doc_version->name);
+    snprintf(desc, size, "%s (Wine %s), %s, %s", dll, build, exe, params);
+    key = hash_bytes(key, desc, strlen(desc));
+    return (key != 0 ? key : 1);
+}
+
+static int cached_result_cmp(const void *a, const void *b)
+{
+    const struct cached_result *x = a, *y = b;
+
+    if (x->key != y->key) return (x->key > y->key) - (x->key < y->key);
+    return x->how - y->how;
+}
+
+static const struct cached_result *find_result(ULONGLONG key, int how)
+{
+    struct cached_result wanted;
+
+    wanted.key = key;
+    wanted.how = how;
+    return bsearch(&wanted, result_cache.results, result_cache.count,
+                   sizeof(wanted), cached_result_cmp);
+}
+
+static void add_result(const struct cached_result *r)
+{
+    int i;
+
+    if (result_cache.count == result_cache.size)
+    {
+        result_cache.size = (result_cache.size ? 2 * result_cache.size : 1024);
+        result_cache.results = realloc(result_cache.results,
+                                       result_cache.size * sizeof(*result_cache.results));
+        assert(result_cache.results != NULL);
+    }
+    result_cache.results[result_cache.count++] = *r;
+
+    for (i = result_cache.nkeys - 1; i >= 0 && result_cache.keys[i] != r->key; i--);
+    if (i < 0)
+    {
+        result_cache.keys = realloc(result_cache.keys,
+                                    (result_cache.nkeys + 1) * sizeof(*result_cache.keys));
+        assert(result_cache.keys != NULL);
+        result_cache.keys[result_cache.nkeys++] = r->key;
+    }
+}
+
+/* Load the results in filename; a file that doesn't exist yet is an empty cache */
+static void load_result_cache(const char *filename)
+{
+    FILE *f = fopen(filename, "r");
+    char line[1024];
+    int lineno = 0;
+
+    if (f == NULL)
+        return;
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        struct cached_result r;
+        char *p = line;
+
+        lineno++;
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+            continue;
+        r.key = strtoull(p, &p, 16);
+        r.how = strtol(p, &p, 10);
+        r.rating = strtol(p, &p, 10);
+        r.first_failure = strtoul(p, &p, 16);
+        r.calls = strtol(p, &p, 10);
+        r.has_xml = strtol(p, &p, 10);
+        r.raw_hash = strtoull(p, &p, 16);
+        r.canon_hash = strtoull(p, &p, 16);
+        if (r.key == 0 || r.how < 0 || r.how > M_TEST_FLAGS_ALL ||
+            r.rating < RATE_OPTIM || r.rating > RATE_FAIL || (*p != ' ' && *p != '\n'))
+        {
+            printf("Ignoring malformed line %d of %s\n", lineno, filename);
+            continue;
+        }
+        while (*p == ' ') p++;
+        p[strcspn(p, "\r\n")] = '\0';
+        r.reason = strdup(p);
+        assert(r.reason != NULL);
+        add_result(&r);
+    }
+    fclose(f);
+    qsort(result_cache.results, result_cache.count, sizeof(*result_cache.results),
+          cached_result_cmp);
+}
+
+static BOOL results_differ(const struct cached_result *a, const struct cached_result *b)
+{
+    return a->rating != b->rating || a->first_failure != b->first_failure ||
+           a->has_xml != b->has_xml || (a->has_xml && a->raw_hash != b->raw_hash);
+}
+
+/* Did the result of how on the key stored before key differ from one on an earlier key? */
+static BOOL changed_on_previous(ULONGLONG key, int how)
+{
+    const struct cached_result *prev = NULL, *old;
+    int i;
+
+    for (i = result_cache.nkeys - 1; i >= 0 && prev == NULL; i--)
+        if (result_cache.keys[i] != key && (prev = find_result(result_cache.keys[i], how)) == NULL)
+            return FALSE;
+    for (; i >= 0; i--)
+        if (result_cache.keys[i] != key &&
+            (old = find_result(result_cache.keys[i], how)) != NULL && results_differ(prev, old))
+            return TRUE;
+    return FALSE;
+}
+
+/* Fill in the cases known under key, dropping the unchanged ones if changed_only.
+ * Returns the number of cases left.
+ */
+static int apply_result_cache(struct soap_case *cases, int count, ULONGLONG key,
+                              BOOL changed_only)
+{
+    int i, n = 0, ncached = 0, nother = 0;
+
+    for (i = 0; i < result_cache.nkeys; i++)
+        nother += (result_cache.keys[i] != key);
+    if (changed_only && nother < 2)
+    {
+        printf("The result cache has no two other msxml3 builds to compare, running all\n");
+        changed_only = FALSE;
+    }
+    for (i = 0; i < count; i++)
+    {
+        struct soap_case *c = &cases[n];
+        const struct cached_result *r;
+
+        *c = cases[i];
+        if (changed_only && !changed_on_previous(key, c->how))
+            continue;
+        n++;
+        if ((r = find_result(key, c->how)) == NULL)
+            continue;
+        c->cached = TRUE;
+        c->rating = r->rating;
+        c->reason = r->reason;
+        c->first_failure = r->first_failure;
+        c->calls = r->calls;
+        c->has_xml = r->has_xml;
+        c->raw_hash = r->raw_hash;
+        c->canon_hash = r->canon_hash;
+        ncached++;
+    }
+    if (changed_only)
+        printf("%d of %d cases changed on the previous msxml3\n", n, count);
+    printf("%d of %d cases taken from the result cache\n", ncached, n);
+    return n;
+}
+
+/* Append the results of the cases run (not those from the cache) to filename */
+static BOOL store_results(const char *filename, ULONGLONG key, const char *desc,
+                          const struct soap_case *cases, int count)
+{
+    FILE *f;
+    int i;
+
+    if (count == 0)
+        return TRUE;
+    if ((f = fopen(filename, "a")) == NULL)
+    {
+        printf("Cannot write to %s\n", filename);
+        return FALSE;
+    }
+    for (i = 0; i < result_cache.nkeys && result_cache.keys[i] != key; i++);
+    if (i == result_cache.nkeys)
+        fprintf(f, "# %08x%08x: %s\n", (unsigned int)(key >> 32), (unsigned int)key, desc);
+    for (i = 0; i < count; i++)
+    {
+        const struct soap_case *c = &cases[i];
+
+        if (c->cached) continue;
+        fprintf(f, "%08x%08x %d %d %08"PRIxHR" %d %d %08x%08x %08x%08x %s\n",
+                (unsigned int)(key >> 32), (unsigned int)key, c->how, c->rating,
+                c->first_failure, c->calls, c->has_xml,
+                (unsigned int)(c->raw_hash >> 32), (unsigned int)c->raw_hash,
+                (unsigned int)(c->canon_hash >> 32), (unsigned int)c->canon_hash, c->reason);
+    }
+    fclose(f);
+    return TRUE;
+}
+
+static void free_result_cache(void)
+{
+    int i;
+
+    for (i = 0; i < result_cache.count; i++)
+        free(result_cache.results[i].reason);
+    free(result_cache.results);
+    free(result_cache.keys);
+    memset(&result_cache, 0, sizeof(result_cache));
+}
+
+static void print_samples(const char *name, struct samples *s)
+{
+    printf("%-28s %8d %10.3f %10.3f %10.3f %12.0f\n", name, s->count,
+           1000.0 * samples_percentile(s, 0.0), 1000.0 * samples_percentile(s, 50.0),
+           1000.0 * samples_percentile(s, 99.0),
+           (s->total > 0.0 ? 1000.0 * s->count / s->total : 0.0));
+}
+
+/* Compare what a fresh document costs with what making a used one empty costs: the
+ * first is CoCreateInstance, the properties and the final Release, the second a reset
+ * (each way of -R) of a document just filled by this HOW.
+ */
+static void bench_doc_lifecycle(int how, int iterations)
+{
+    struct samples fresh = { NULL, 0, 0, 0.0 }, reset[RESET_LOADXML + 1];
+    IXMLDOMDocument *doc;
+    double start;
+    int i, failures = 0;
+    enum doc_reset r;
+
+    memset(reset, 0, sizeof(reset));
+    for (i = 0; i < iterations; i++)
+    {
+        start = now_ms();
+        if (create_doc(&doc) != S_OK) break;
+        configure_doc(doc);
+        IXMLDOMDocument_Release(doc);
+        samples_add(&fresh, now_ms() - start);
+
+        for (r = RESET_REMOVE; r <= RESET_LOADXML; r++)
+        {
+            if (create_doc(&doc) != S_OK) break;
+            configure_doc(doc);
+            test_build_soap(doc, how);
+            start = now_ms();
+            failures += (reset_doc(doc, r) != S_OK);
+            samples_add(&reset[r], now_ms() - start);
+            IXMLDOMDocument_Release(doc);
+        }
+    }
+
+    print_samples("fresh document + Release", &fresh);
+    print_samples("reset by removeChild", &reset[RESET_REMOVE]);
+    print_samples("reset by loadXML", &reset[RESET_LOADXML]);
+    if (failures)
+        printf("%d resets didn't leave the document empty\n", failures);
+    free(fresh.v);
+    for (r = RESET_REMOVE; r <= RESET_LOADXML; r++)
+        free(reset[r].v);
+}
+
+/* Build the request iterations times from scratch and as many times from the template,
+ * and check that both give the same XML.  The XML of each mode is rated and hashed in
+ * one untimed run before its timed ones.
+ */
+static void bench_templates(int how, int iterations)
+{
+    struct samples ms[2];
+    ULONGLONG hash[2] = { 0, 0 };
+    BOOL has_xml[2] = { FALSE, FALSE }, saved = use_templates;
+    int i, mode;
+
+    memset(ms, 0, sizeof(ms));
+    for (mode = 0; mode < 2; mode++)
+    {
+        struct soap_case c;
+
+        use_templates = mode;
+        memset(&c, 0, sizeof(c));
+        c.how = how;
+        run_case(&c);
+        has_xml[mode] = c.has_xml;
+        hash[mode] = c.raw_hash;
+
+        skip_rating = TRUE;
+        for (i = 0; i < iterations; i++)
+        {
+            memset(&c, 0, sizeof(c));
+            c.how = how;
+            run_case(&c);
+            if (c.ms >= 0.0)
+                samples_add(&ms[mode], c.ms);
+        }
+        skip_rating = FALSE;
+    }
+    use_templates = saved;
+
+    print_samples("whole case from scratch", &ms[0]);
+    print_samples("whole case from template", &ms[1]);
+    if (save_to_stream)
+        printf("(no comparison of the XML with -s)\n");
+    else if (!has_xml[0] && !has_xml[1])
+        printf("XML from the template: no XML in either mode\n");
+    else
+        printf("XML from the template is %s the XML built from scratch\n",
+               (has_xml[0] == has_xml[1] && hash[0] == hash[1] ? "identical to"
+                                                               : "DIFFERENT from"));
+    for (mode = 0; mode < 2; mode++)
+        free(ms[mode].v);
+}
+
+/* Run test_build_soap iterations times for one HOW value and print, per DOM call, the
+ * minimum, median and 99th percentile latency and the rate it could be called at.
+ * Only the warm-up run is rated; the timed ones skip rating and storing (-u) the XML.
+ */
+static void run_benchmark(int how, int iterations)
+{
+    struct soap_case c;
+    struct samples cases = { NULL, 0, 0, 0.0 };
+    enum soap_rating rating;
+    int i, op, no_doc = 0;
+
+    memset(&c, 0, sizeof(c));
+    c.how = how;
+    run_case(&c);  /* warm up and rate, not counted */
+    rating = c.rating;
+
+    for (op = 0; op < OP_COUNT; op++)
+        samples_clear(&op_samples[op]);
+    bench_ops = TRUE;
+    skip_rating = TRUE;
+    for (i = 0; i < iterations; i++)
+    {
+        memset(&c, 0, sizeof(c));
+        c.how = how;
+        run_case(&c);
+        if (c.ms < 0.0)
+            no_doc++;
+        else
+            samples_add(&cases, c.ms);
+    }
+    skip_rating = FALSE;
+    bench_ops = FALSE;
+
+    printf("========== Benchmark (how = %4d = 0x%04x, %d iterations, %s): ==========\n",
+           how, how, iterations, rating_name(rating));
+    printf("Payload: %d argument%s, depth %d, values of %d characters\n",
+           soap_nargs, (soap_nargs > 1 ? "s" : ""), soap_depth, soap_value_len);
+    printf("%-28s %8s %10s %10s %10s %12s\n",
+           "operation", "calls", "min us", "median us", "p99 us", "ops/sec");
+    for (op = 0; op < OP_COUNT; op++)
+        if (op_samples[op].count > 0)
+            print_samples(op_names[op], &op_samples[op]);
+    print_samples((doc_reset == RESET_NONE ? "whole case (incl. new doc)"
+                                           : "whole case (incl. reset)"), &cases);
+    if (no_doc)
+        printf("%d iterations got no document and are not counted\n", no_doc);
+    free(cases.v);
+
+    printf("---------- Document lifecycle: ----------\n");
+    bench_doc_lifecycle(how, iterations);
+    printf("---------- Template (cloneNode) vs from scratch: ----------\n");
+    bench_templates(how, iterations);
+}
+
+/***** Streaming generation with MXXMLWriter ******************************************/
+
+/* The same request made without any DOM: ISAXContentHandler calls on an MXXMLWriter
+ * that writes into a memory stream.  There is no HOW here, it always writes the wanted
+ * form (that of HOW 2738): the SOAP-ENV prefix on Envelope and Body, xsd and xsi bound
+ * on Envelope, and wso2.org as default namespace from Login down.  MXXMLWriter doesn't
+ * write anything for startPrefixMapping, so the xmlns attributes are passed to
+ * startElement as ordinary attributes.
+ */
+struct sax_gen
+{
+    IMXWriter *writer;
+    ISAXContentHandler *handler;
+    IMXAttributes *mxattrs;
+    ISAXAttributes *attrs;
+    IStream *stream;
+    HGLOBAL hglobal;        /* of the stream, locked while the caller reads the XML */
+};
+
+#define SAX_CALL(call) \
+    do { if ((hr = (call)) != S_OK) goto CleanReturn; } while(0)
+
+static void sax_free(struct sax_gen *g)
+{
+    if (g->stream) IStream_Release(g->stream);
+    if (g->attrs) ISAXAttributes_Release(g->attrs);
+    if (g->mxattrs) IMXAttributes_Release(g->mxattrs);
+    if (g->handler) ISAXContentHandler_Release(g->handler);
+    if (g->writer) IMXWriter_Release(g->writer);
+    memset(g, 0, sizeof(*g));
+}
+
+static HRESULT sax_init(struct sax_gen *g)
+{
+    HRESULT hr;
+
+    memset(g, 0, sizeof(*g));
+    SAX_CALL(CoCreateInstance(&CLSID_MXXMLWriter, NULL, CLSCTX_INPROC_SERVER,
+                              &IID_IMXWriter, (void**)&g->writer));
+    SAX_CALL(IMXWriter_QueryInterface(g->writer, &IID_ISAXContentHandler,
+                                      (void**)&g->handler));
+    SAX_CALL(CoCreateInstance(&CLSID_SAXAttributes, NULL, CLSCTX_INPROC_SERVER,
+                              &IID_IMXAttributes, (void**)&g->mxattrs));
+    SAX_CALL(IMXAttributes_QueryInterface(g->mxattrs, &IID_ISAXAttributes, (void**)&g->attrs));
+    SAX_CALL(CreateStreamOnHGlobal(NULL, TRUE, &g->stream));
+
+    /* UTF-16 without BOM and our own declaration, like get_xml gives it */
+    SAX_CALL(IMXWriter_put_encoding(g->writer, CONST_BSTR("UTF-16")));
+    SAX_CALL(IMXWriter_put_byteOrderMark(g->writer, VARIANT_FALSE));
+    SAX_CALL(IMXWriter_put_omitXMLDeclaration(g->writer, VARIANT_TRUE));
+
+CleanReturn:
+    if (hr != S_OK)
+        sax_free(g);
+    return hr;
+}
+
+static HRESULT sax_xmlns_attr(struct sax_gen *g, struct cstr qname, struct cstr uri)
+{
+    return IMXAttributes_addAttribute(g->mxattrs, CONST_BSTR(""), CONST_BSTR(""), qname.w,
+                                      CONST_BSTR("CDATA"), uri.w);
+}
+
+static HRESULT sax_start(struct sax_gen *g, struct cstr uri, struct cstr local,
+                         struct cstr qname)
+{
+    return ISAXContentHandler_startElement(g->handler, uri.w, SysStringLen(uri.w),
+                                           local.w, SysStringLen(local.w),
+                                           qname.w, SysStringLen(qname.w), g->attrs);
+}
+
+static HRESULT sax_end(struct sax_gen *g, struct cstr uri, struct cstr local,
+                       struct cstr qname)
+{
+    return ISAXContentHandler_endElement(g->handler, uri.w, SysStringLen(uri.w),
+                                         local.w, SysStringLen(local.w),
+                                         qname.w, SysStringLen(qname.w));
+}
+
+/* One argument of Login with depth - 1 levels of "item" below it, like add_soap_arg:
+ * all the start tags in one loop, the value, then all the end tags in another.
+ */
+static HRESULT sax_arg(struct sax_gen *g, struct cstr name, int depth)
+{
+    HRESULT hr;
+    int level;
+
+    if (depth < 1) depth = 1;
+    for (level = 0; level < depth; level++)
+        SAX_CALL(sax_start(g, CSTR(WSO2_URI), (level == 0 ? name : CSTR("item")),
+                           (level == 0 ? name : CSTR("item"))));
+    if (soap_value_len > 0)
+    {
+        struct cstr value = soap_value();
+        SAX_CALL(ISAXContentHandler_characters(g->handler, value.w, SysStringLen(value.w)));
+    }
+    for (level = depth - 1; level >= 0; level--)
+        SAX_CALL(sax_end(g, CSTR(WSO2_URI), (level == 0 ? name : CSTR("item")),
+                         (level == 0 ? name : CSTR("item"))));
+
+CleanReturn:
+    return hr;
+}
+
+/* Write the request into the stream of g; on success *xml is the NUL-terminated XML,
+ * valid until sax_done().
+ */
+static HRESULT build_soap_sax(struct sax_gen *g, const WCHAR **xml)
+{
+    static const WCHAR crlfW[] = {'\r','\n'}, nulW[] = {0};
+    LARGE_INTEGER zero;
+    ULARGE_INTEGER size;
+    VARIANT dest;
+    HRESULT hr;
+    int i;
+
+    zero.QuadPart = size.QuadPart = 0;
+    SAX_CALL(IStream_Seek(g->stream, zero, STREAM_SEEK_SET, NULL));
+    SAX_CALL(IStream_SetSize(g->stream, size));
+    V_VT(&dest) = VT_UNKNOWN;
+    V_UNKNOWN(&dest) = (IUnknown*)g->stream;
+    SAX_CALL(IMXWriter_put_output(g->writer, dest));
+
+    SAX_CALL(ISAXContentHandler_startDocument(g->handler));
+    SAX_CALL(ISAXContentHandler_processingInstruction(g->handler, CONST_BSTR("xml"), 3,
+                                                      CONST_BSTR("version=\"1.0\""), 13));
+    SAX_CALL(ISAXContentHandler_ignorableWhitespace(g->handler, crlfW, 2));
+
+    SAX_CALL(IMXAttributes_clear(g->mxattrs));
+    SAX_CALL(sax_xmlns_attr(g, CSTR("xmlns:SOAP-ENV"), CSTR(SOAP_ENV_URI)));
+    SAX_CALL(sax_xmlns_attr(g, CSTR("xmlns:xsd"), CSTR(XSD_URI)));
+    SAX_CALL(sax_xmlns_attr(g, CSTR("xmlns:xsi"), CSTR(XSI_URI)));
+    SAX_CALL(sax_start(g, CSTR(SOAP_ENV_URI), CSTR("Envelope"), CSTR("SOAP-ENV:Envelope")));
+    SAX_CALL(IMXAttributes_clear(g->mxattrs));
+    SAX_CALL(sax_start(g, CSTR(SOAP_ENV_URI), CSTR("Body"), CSTR("SOAP-ENV:Body")));
+    SAX_CALL(sax_xmlns_attr(g, CSTR("xmlns"), CSTR(WSO2_URI)));
+    SAX_CALL(sax_start(g, CSTR(WSO2_URI), CSTR("Login"), CSTR("Login")));
+    SAX_CALL(IMXAttributes_clear(g->mxattrs));
+
+    for (i = 0; i < soap_nargs; i++)
+    {
+        char name[16];
+
+        sprintf(name, "arg%d", i + 1);
+        SAX_CALL(sax_arg(g, (i == 0 ? CSTR("code") : cstr_interned(name)), soap_depth));
+    }
+
+    SAX_CALL(sax_end(g, CSTR(WSO2_URI), CSTR("Login"), CSTR("Login")));
+    SAX_CALL(sax_end(g, CSTR(SOAP_ENV_URI), CSTR("Body"), CSTR("SOAP-ENV:Body")));
+    SAX_CALL(sax_end(g, CSTR(SOAP_ENV_URI), CSTR("Envelope"), CSTR("SOAP-ENV:Envelope")));
+    SAX_CALL(ISAXContentHandler_ignorableWhitespace(g->handler, crlfW, 2));
+    SAX_CALL(ISAXContentHandler_endDocument(g->handler));
+
+    /* endDocument has flushed everything into the stream; terminate and map it */
+    SAX_CALL(IStream_Write(g->stream, nulW, sizeof(nulW), NULL));
+    SAX_CALL(GetHGlobalFromStream(g->stream, &g->hglobal));
+    *xml = GlobalLock(g->hglobal);
+    if (track_mem) mem_at_output = private_bytes();
+
+CleanReturn:
+    return hr;
+}
+
+static void sax_done(struct sax_gen *g)
+{
+    if (g->hglobal != NULL)
+        GlobalUnlock(g->hglobal);
+    g->hglobal = NULL;
+}
+
+/* Compare the MXXMLWriter generator with the DOM one for a HOW value: first whether
+ * they write the same XML, then the time per request, the rate of XML written and how
+ * much the private bytes have grown while the finished XML is still at hand.
+ */
+static BOOL compare_generators(int how, int iterations)
+{
+    struct sax_gen g;
+    struct soap_case c;
+    struct samples ms[2];
+    SIZE_T growth[2] = { 0, 0 }, before;
+    const WCHAR *xml;
+    const char *reason;
+    enum soap_rating rating;
+    ULONGLONG canon_hash;
+    int i, xml_len = 0, no_doc = 0;
+    BOOL same;
+    HRESULT hr;
+
+    if ((hr = sax_init(&g)) != S_OK)
+    {
+        printf("MXXMLWriter is not available (0x%08"PRIxHR")\n", hr);
+        return FALSE;
+    }
+
+    memset(&c, 0, sizeof(c));
+    c.how = how;
+    run_case(&c);
+    if ((hr = build_soap_sax(&g, &xml)) != S_OK)
+    {
+        printf("Writing the request with MXXMLWriter failed (0x%08"PRIxHR")\n", hr);
+        sax_done(&g);
+        sax_free(&g);
+        return FALSE;
+    }
+    xml_len = lstrlenW(xml);
+    rating = rate_soap_xml(xml, &reason, &canon_hash);
+    same = (c.has_xml && fnv_span(FNV_OFFSET, xml, xml_len) == c.raw_hash);
+
+    printf("========== DOM (how = %4d = 0x%04x) vs MXXMLWriter: ==========\n", how, how);
+    printf("DOM %s, MXXMLWriter %s%s%s: XML %s\n", rating_name(c.rating), rating_name(rating),
+           (*reason ? ", " : ""), reason,
+           (same ? "identical" :
+            c.has_xml && canon_hash == c.canon_hash ? "the same after namespace canonicalization"
+                                                    : "DIFFERENT"));
+    if (!same)
+    {
+        fflush(stdout);
+        out_quiet = FALSE;
+        out_printf("MXXMLWriter wrote:\n");
+        out_write_wide(xml, xml_len);
+        out_quiet = TRUE;
+        fflush(out_file);
+    }
+    sax_done(&g);
+
+    /* Like run_benchmark, the DOM side isn't rated (nor stored with -u) while timed */
+    memset(ms, 0, sizeof(ms));
+    track_mem = TRUE;
+    skip_rating = TRUE;
+    for (i = 0; i < iterations; i++)
+    {
+        double start, sax_ms;
+
+        memset(&c, 0, sizeof(c));
+        c.how = how;
+        before = private_bytes();
+        run_case(&c);
+        if (c.ms < 0.0)
+            no_doc++;
+        else
+        {
+            samples_add(&ms[0], c.ms);
+            if (mem_at_output > before && mem_at_output - before > growth[0])
+                growth[0] = mem_at_output - before;
+        }
+
+        before = private_bytes();
+        start = now_ms();
+        hr = build_soap_sax(&g, &xml);
+        sax_done(&g);
+        sax_ms = now_ms() - start;
+        if (hr != S_OK) break;
+        samples_add(&ms[1], sax_ms);
+        if (mem_at_output > before && mem_at_output - before > growth[1])
+            growth[1] = mem_at_output - before;
+    }
+    skip_rating = FALSE;
+    track_mem = FALSE;
+
+    printf("%-28s %8s %10s %10s %10s %12s\n",
+           "generator", "requests", "min us", "median us", "p99 us", "requests/s");
+    print_samples("DOM (incl. document)", &ms[0]);
+    print_samples("MXXMLWriter", &ms[1]);
+    if (no_doc)
+        printf("%d DOM requests got no document and are not counted\n", no_doc);
+    if (hr != S_OK)
+        printf("MXXMLWriter failed after %d requests (0x%08"PRIxHR")\n", i, hr);
+    printf("XML of %d characters: DOM %.1f MB/s, MXXMLWriter %.1f MB/s (median)\n", xml_len,
+           2.0 * xml_len / 1000.0 / samples_percentile(&ms[0], 50.0),
+           2.0 * xml_len / 1000.0 / samples_percentile(&ms[1], 50.0));
+    printf("Largest growth of private bytes per request: DOM %lu KB, MXXMLWriter %lu KB\n",
+           (unsigned long)(growth[0] / 1024), (unsigned long)(growth[1] / 1024));
+
+    for (i = 0; i < 2; i++)
+        free(ms[i].v);
+    sax_free(&g);
+    return TRUE;
+}
+
+/***** Spliced requests without any DOM ***********************************************/
+
+/* For a given HOW, the XML of a request is the same every time except for the texts of
+ * the arguments.  So make it once with the DOM, with a placeholder as the text of every
+ * argument, and cut it at the placeholders.  A request (-S) is then those pieces with
+ * the XML-escaped values in between; no COM call at all.  Every splice_verify-th
+ * request is also built with the DOM, and must give exactly the same XML.
+ */
+#define SPLICE_MARK     "@splice@"
+
+struct splice_tmpl
+{
+    BSTR xml;               /* of the document with placeholders */
+    int *start, *end;       /* piece i of the XML is [start[i], end[i]) */
+    int npieces;            /* the number of values + 1 */
+};
+
+static int splice_verify = 16;  /* -V: build every Nth spliced request with the DOM too */
+
+/* A growing UTF-16 buffer for the spliced requests */
+struct wbuf
+{
+    WCHAR *data;
+    int len, size;
+};
+
+static void wbuf_reserve(struct wbuf *b, int len)
+{
+    if (b->size - b->len >= len) return;
+
+    b->size = (b->size ? 2 * b->size : 4096);
+    if (b->size < b->len + len) b->size = b->len + len;
+    b->data = realloc(b->data, b->size * sizeof(WCHAR));
+    assert(b->data != NULL);
+}
+
+static inline void wbuf_add(struct wbuf *b, const WCHAR *str, int len)
+{
+    wbuf_reserve(b, len);
+    memcpy(b->data + b->len, str, len * sizeof(WCHAR));
+    b->len += len;
+}
+
+/* Append str with &, < and > escaped like msxml does it in text nodes (quotes aren't) */
+static void wbuf_add_escaped(struct wbuf *b, const char *str)
+{
+    static const WCHAR ampW[] = {'&','a','m','p',';'}, ltW[] = {'&','l','t',';'},
+                       gtW[] = {'&','g','t',';'};
 
+    for (; *str; str++)
+    {
+        switch (*str)
+        {
+        case '&': wbuf_add(b, ampW, 5); break;
+        case '<': wbuf_add(b, ltW, 4); break;
+        case '>': wbuf_add(b, gtW, 4); break;
+        default:
+            wbuf_reserve(b, 1);
+            b->data[b->len++] = (unsigned char)*str;
+            break;
+        }
+    }
+}
+
+/* Build the request for how with the DOM, with the given argument values, into *xml */
+static HRESULT make_soap_xml(int how, const struct cstr *values, BSTR *xml)
+{
+    IXMLDOMDocument *doc;
+    IXMLDOMElement *soapCall;
+    HRESULT hr;
+    int bstrs_mark = mark_bstrs();
+
+    *xml = NULL;
+    if ((hr = get_doc(&doc)) != S_OK) return hr;
+
+    hr = E_FAIL;
+    if ((soapCall = build_soap_skeleton(doc, how)) != NULL)
+    {
+        if (add_soap_args(doc, soapCall, how, values))
+            hr = IXMLDOMDocument_get_xml(doc, xml);
+        IXMLDOMElement_Release(soapCall);
+    }
+    put_doc(doc);
+    release_bstrs(bstrs_mark);
+    return hr;
+}
+
+static BOOL make_splice_tmpl(struct splice_tmpl *t, int how)
+{
+    static const WCHAR markW[] = {'@','s','p','l','i','c','e','@'};
+    struct cstr *values = malloc(soap_nargs * sizeof(*values));
+    int i, pos, len;
+
+    assert(values != NULL);
+    for (i = 0; i < soap_nargs; i++)
+        values[i] = CSTR(SPLICE_MARK);
+    memset(t, 0, sizeof(*t));
+    if (make_soap_xml(how, values, &t->xml) != S_OK)
+    {
+        free(values);
+        return FALSE;
+    }
+    free(values);
+
+    t->start = malloc((soap_nargs + 1) * sizeof(int));
+    t->end = malloc((soap_nargs + 1) * sizeof(int));
+    assert(t->start != NULL && t->end != NULL);
+    len = SysStringLen(t->xml);
+    t->start[0] = 0;
+    for (pos = 0; pos + 8 <= len; pos++)
+    {
+        if (memcmp(t->xml + pos, markW, sizeof(markW))) continue;
+        if (t->npieces == soap_nargs) return FALSE;  /* more placeholders than values */
+        t->end[t->npieces++] = pos;
+        t->start[t->npieces] = pos + 8;
+        pos += 7;
+    }
+    t->end[t->npieces++] = len;
+    return (t->npieces == soap_nargs + 1);
+}
+
+static void free_splice_tmpl(struct splice_tmpl *t)
+{
+    SysFreeString(t->xml);
+    free(t->start);
+    free(t->end);
+}
+
+static void splice_request(const struct splice_tmpl *t, char * const *values, struct wbuf *b)
+{
+    int i;
+
+    b->len = 0;
+    for (i = 0; i < t->npieces; i++)
+    {
+        wbuf_add(b, t->xml + t->start[i], t->end[i] - t->start[i]);
+        if (i < t->npieces - 1)
+            wbuf_add_escaped(b, values[i]);
+    }
+}
+
+/* The value of argument arg in request number request: different every time, with the
+ * characters that need escaping, and padded to the -v size.
+ */
+static void make_value(char *buf, int size, int request, int arg)
+{
+    int len = snprintf(buf, size, "%d.%d <&> \"'", request, arg);
+
+    if (len >= size) len = size - 1;
+    for (; len < soap_value_len && len < size - 1; len++)
+        buf[len] = '0' + len % 10;
+    buf[len] = '\0';
+}
+
+/* Splice iterations requests for how and print how long they take, compared to building
+ * the verified ones with the DOM, and whether the verified ones came out the same.
+ */
+static BOOL splice_requests(int how, int iterations)
+{
+    struct splice_tmpl t;
+    struct samples ms[2];
+    struct wbuf b = { NULL, 0, 0 };
+    int value_size = (soap_value_len > 40 ? soap_value_len : 40) + 1;
+    char **values = malloc(soap_nargs * sizeof(*values));
+    struct cstr *dom_values = malloc(soap_nargs * sizeof(*dom_values));
+    int i, j, verified = 0, different = 0;
+    double start;
+
+    assert(values != NULL && dom_values != NULL);
+    for (i = 0; i < soap_nargs; i++)
+    {
+        values[i] = malloc(value_size);
+        assert(values[i] != NULL);
+    }
+
+    printf("========== Spliced requests (how = %4d = 0x%04x): ==========\n", how, how);
+    start = now_ms();
+    if (!make_splice_tmpl(&t, how))
+    {
+        printf("No template: the DOM failed or the placeholders didn't come out as text\n");
+        free_splice_tmpl(&t);
+        for (i = 0; i < soap_nargs; i++)
+            free(values[i]);
+        free(values);
+        free(dom_values);
+        return TRUE;   /* nothing to compare, like a failing HOW in a sweep */
+    }
+    printf("Template made with the DOM in %.3f ms: %d pieces, %d characters\n",
+           now_ms() - start, t.npieces, SysStringLen(t.xml));
+
+    memset(ms, 0, sizeof(ms));
+    for (i = 0; i < iterations; i++)
+    {
+        for (j = 0; j < soap_nargs; j++)
+            make_value(values[j], value_size, i, j);
+
+        start = now_ms();
+        splice_request(&t, values, &b);
+        samples_add(&ms[0], now_ms() - start);
+
+        if (splice_verify > 0 && i % splice_verify == 0)
+        {
+            int bstrs_mark = mark_bstrs();
+            BSTR xml;
+            BOOL same;
+
+            for (j = 0; j < soap_nargs; j++)
+            {
+                dom_values[j].a = values[j];
+                dom_values[j].w = _bstr_(values[j]);
+            }
+            start = now_ms();
+            if (make_soap_xml(how, dom_values, &xml) != S_OK)
+                xml = NULL;
+            samples_add(&ms[1], now_ms() - start);
+            release_bstrs(bstrs_mark);
+
+            same = (xml != NULL && SysStringLen(xml) == b.len &&
+                    !memcmp(xml, b.data, b.len * sizeof(WCHAR)));
+            if (!same && different++ == 0)
+            {
+                printf("Request %d differs from the DOM; spliced:\n", i);
+                fflush(stdout);
+                out_quiet = FALSE;
+                out_write_wide(b.data, b.len);
+                out_printf("\nDOM:\n");
+                if (xml) out_write_wide(xml, SysStringLen(xml));
+                out_quiet = TRUE;
+                fflush(out_file);
+            }
+            verified++;
+            SysFreeString(xml);
+        }
+    }
+
+    printf("%-28s %8s %10s %10s %10s %12s\n",
+           "generator", "requests", "min us", "median us", "p99 us", "requests/s");
+    print_samples("spliced", &ms[0]);
+    if (verified > 0)
+    {
+        print_samples("DOM (verified requests)", &ms[1]);
+        printf("Spliced is %.1f times faster (median); %d of %d requests verified, %d %s\n",
+               samples_percentile(&ms[1], 50.0) / samples_percentile(&ms[0], 50.0),
+               verified, iterations, different, (different ? "DIFFERENT" : "different"));
+    }
+
+    for (i = 0; i < 2; i++)
+        free(ms[i].v);
+    free(b.data);
+    free_splice_tmpl(&t);
+    for (i = 0; i < soap_nargs; i++)
+        free(values[i]);
+    free(values);
+    free(dom_values);
+    return (different == 0);
+}
+
+/***** XPath extraction vs walking the DOM *********************************************/
+
+/* Reading results back out of a document: a fixed set of namespace-aware XPath queries,
+ * with the prefixes mapped through the SelectionNamespaces property, each against a
+ * hand-written walk over the DOM finding the same thing (-x).  Only documents with the
+ * wanted namespaces give results; for the others both must find nothing.
+ */
+enum xpath_query
+{
+    XQ_LOGIN,
+    XQ_FIRST_ARG,
+    XQ_LAST_ARG,
+    XQ_ALL_WSO2,            /* the only query returning a node list */
+    XQ_COUNT
+};
+
+static const struct
+{
+    const char *name, *xpath;
+} xpath_queries[XQ_COUNT] =
+{
+    { "Login",              "/SOAP-ENV:Envelope/SOAP-ENV:Body/w:Login" },
+    { "first argument",     "/SOAP-ENV:Envelope/SOAP-ENV:Body/w:Login/w:code" },
+    { "last argument",      "/SOAP-ENV:Envelope/SOAP-ENV:Body/w:Login/*[last()]" },
+    { "all wso2 elements",  "//w:*" },
+};
+
+/* Is node an element in namespace uri (any if NULL) with local name local (any if NULL)? */
+static BOOL node_is(IXMLDOMNode *node, const char *uri, const char *local)
+{
+    DOMNodeType type;
+    BSTR str = NULL;
+    BOOL ret = TRUE;
+
+    if (IXMLDOMNode_get_nodeType(node, &type) != S_OK || type != NODE_ELEMENT)
+        return FALSE;
+    if (uri != NULL)
+    {
+        IXMLDOMNode_get_namespaceURI(node, &str);
+        ret = span_is(str, SysStringLen(str), uri);
+        SysFreeString(str);
+    }
+    if (ret && local != NULL)
+    {
+        str = NULL;
+        IXMLDOMNode_get_baseName(node, &str);
+        ret = span_is(str, SysStringLen(str), local);
+        SysFreeString(str);
+    }
+    return ret;
+}
+
+/* The first (or last) child element of parent matching node_is(uri, local), or NULL */
+static IXMLDOMNode *find_child(IXMLDOMNode *parent, const char *uri, const char *local,
+                               BOOL last)
+{
+    IXMLDOMNode *child, *next, *found = NULL;
+
+    if (parent == NULL || IXMLDOMNode_get_firstChild(parent, &child) != S_OK)
+        return NULL;
+    while (child != NULL)
+    {
+        if (node_is(child, uri, local))
+        {
+            if (found != NULL) IXMLDOMNode_Release(found);
+            found = child;
+            IXMLDOMNode_AddRef(found);
+            if (!last)
+            {
+                IXMLDOMNode_Release(child);
+                break;
+            }
+        }
+        if (IXMLDOMNode_get_nextSibling(child, &next) != S_OK) next = NULL;
+        IXMLDOMNode_Release(child);
+        child = next;
+    }
+    return found;
+}
+
+/* The number of elements below node in namespace uri (all elements if NULL) */
+static int count_elements(IXMLDOMNode *node, const char *uri)
+{
+    IXMLDOMNode *cur, *next;
+    int count = 0, depth = 0;
+
+    /* Walk the tree in document order without recursing, so any -d fits on the stack;
+     * depth is that of cur below node, the walk ends when it would climb to node.
+     */
+    if (IXMLDOMNode_get_firstChild(node, &cur) != S_OK)
+        return 0;
+    while (cur != NULL)
+    {
+        if (node_is(cur, NULL, NULL))
+        {
+            count += node_is(cur, uri, NULL);
+            if (IXMLDOMNode_get_firstChild(cur, &next) == S_OK && next != NULL)
+            {
+                IXMLDOMNode_Release(cur);
+                cur = next;
+                depth++;
+                continue;
+            }
+        }
+        /* The next sibling of cur or of the nearest of its parents that has one */
+        while (cur != NULL)
+        {
+            if (IXMLDOMNode_get_nextSibling(cur, &next) == S_OK && next != NULL)
+            {
+                IXMLDOMNode_Release(cur);
+                cur = next;
+                break;
+            }
+            if (depth-- == 0 || IXMLDOMNode_get_parentNode(cur, &next) != S_OK) next = NULL;
+            IXMLDOMNode_Release(cur);
+            cur = next;
+        }
+    }
+    return count;
+}
+
+/* What a query found, to check that both ways agree: a hash of the XML of the node
+ * (0 for none), or the number of nodes in the list.
+ */
+static ULONGLONG node_signature(IXMLDOMNode *node)
+{
+    ULONGLONG hash = 0;
+    BSTR xml;
+
+    if (node != NULL && IXMLDOMNode_get_xml(node, &xml) == S_OK)
+    {
+        hash = fnv_span(FNV_OFFSET, xml, SysStringLen(xml));
+        SysFreeString(xml);
+    }
+    return hash;
+}
+
+static ULONGLONG run_xpath(IXMLDOMDocument2 *doc2, enum xpath_query q, BOOL signature)
+{
+    IXMLDOMNodeList *list;
+    IXMLDOMNode *node = NULL;
+    ULONGLONG ret = 0;
+    LONG len = 0;
+
+    if (q == XQ_ALL_WSO2)
+    {
+        if (IXMLDOMDocument2_selectNodes(doc2, _ibstr_(xpath_queries[q].xpath), &list) == S_OK)
+        {
+            IXMLDOMNodeList_get_length(list, &len);
+            IXMLDOMNodeList_Release(list);
+        }
+        return len;
+    }
+    if (IXMLDOMDocument2_selectSingleNode(doc2, _ibstr_(xpath_queries[q].xpath), &node) != S_OK)
+        node = NULL;
+    if (signature) ret = node_signature(node);
+    if (node != NULL) IXMLDOMNode_Release(node);
+    return ret;
+}
+
+static ULONGLONG run_walk(IXMLDOMNode *doc_node, enum xpath_query q, BOOL signature)
+{
+    IXMLDOMNode *envelope, *body, *login, *node = NULL;
+    ULONGLONG ret = 0;
+
+    if (q == XQ_ALL_WSO2)
+        return count_elements(doc_node, WSO2_URI);
+
+    envelope = find_child(doc_node, SOAP_ENV_URI, "Envelope", FALSE);
+    body = find_child(envelope, SOAP_ENV_URI, "Body", FALSE);
+    login = find_child(body, WSO2_URI, "Login", FALSE);
+    switch (q)
+    {
+    case XQ_LOGIN:
+        node = login;
+        login = NULL;
+        break;
+    case XQ_FIRST_ARG:
+        node = find_child(login, WSO2_URI, "code", FALSE);
+        break;
+    case XQ_LAST_ARG:
+        node = find_child(login, NULL, NULL, TRUE);
+        break;
+    default:
+        break;
+    }
+    if (signature) ret = node_signature(node);
+    if (node != NULL) IXMLDOMNode_Release(node);
+    if (login != NULL) IXMLDOMNode_Release(login);
+    if (body != NULL) IXMLDOMNode_Release(body);
+    if (envelope != NULL) IXMLDOMNode_Release(envelope);
+    return ret;
+}
+
+/* Run every query iterations times both ways on the document for how, with the number
+ * of arguments of -n, then 10 and 100 times as many.
+ */
+static BOOL bench_xpath(int how, int iterations)
+{
+    int scale, nargs = soap_nargs, i;
+    BOOL all_agree = TRUE;
+    enum xpath_query q;
+
+    printf("========== XPath vs DOM walk (how = %4d = 0x%04x): ==========\n", how, how);
+    printf("%6s %8s  %-18s %12s %12s %7s  %s\n", "args", "elements", "query",
+           "XPath us", "walk us", "ratio", "agree");
+    for (scale = 1; scale <= 100; scale *= 10)
+    {
+        IXMLDOMDocument *doc;
+        IXMLDOMDocument2 *doc2;
+        IXMLDOMNode *doc_node;
+        IXMLDOMElement *soapCall;
+        int bstrs_mark = mark_bstrs(), nelements;
+        BOOL built = FALSE;
+
+        soap_nargs = nargs * scale;
+        if (create_doc(&doc) != S_OK) break;
+        configure_doc(doc);
+        if ((soapCall = build_soap_skeleton(doc, how)) != NULL)
+        {
+            built = add_soap_args(doc, soapCall, how, NULL);
+            IXMLDOMElement_Release(soapCall);
+        }
+        release_bstrs(bstrs_mark);
+        if (!built ||
+            IXMLDOMDocument_QueryInterface(doc, &IID_IXMLDOMDocument2, (void**)&doc2) != S_OK)
+        {
+            printf("Building the document failed\n");
+            IXMLDOMDocument_Release(doc);
+            break;
+        }
+        IXMLDOMDocument2_setProperty(doc2, CONST_BSTR("SelectionLanguage"),
+                                     cstr_variant(CSTR("XPath")));
+        IXMLDOMDocument2_setProperty(doc2, CONST_BSTR("SelectionNamespaces"),
+                                     cstr_variant(CSTR("xmlns:SOAP-ENV='" SOAP_ENV_URI "' "
+                                                       "xmlns:w='" WSO2_URI "'")));
+        IXMLDOMDocument_QueryInterface(doc, &IID_IXMLDOMNode, (void**)&doc_node);
+        nelements = count_elements(doc_node, NULL);
+
+        for (q = 0; q < XQ_COUNT; q++)
+        {
+            struct samples ms[2];
+            BOOL agree = (run_xpath(doc2, q, TRUE) == run_walk(doc_node, q, TRUE));
+
+            memset(ms, 0, sizeof(ms));
+            for (i = 0; i < iterations; i++)
+            {
+                double start = now_ms();
+                run_xpath(doc2, q, FALSE);
+                samples_add(&ms[0], now_ms() - start);
+
+                start = now_ms();
+                run_walk(doc_node, q, FALSE);
+                samples_add(&ms[1], now_ms() - start);
+            }
+            printf("%6d %8d  %-18s %12.3f %12.3f %7.2f  %s\n", soap_nargs, nelements,
+                   xpath_queries[q].name, 1000.0 * samples_percentile(&ms[0], 50.0),
+                   1000.0 * samples_percentile(&ms[1], 50.0),
+                   samples_percentile(&ms[0], 50.0) / samples_percentile(&ms[1], 50.0),
+                   (agree ? "yes" : "NO"));
+            all_agree = all_agree && agree;
+            free(ms[0].v);
+            free(ms[1].v);
+        }
+        IXMLDOMNode_Release(doc_node);
+        IXMLDOMDocument2_Release(doc2);
+        IXMLDOMDocument_Release(doc);
+    }
+    soap_nargs = nargs;
+    return all_agree;
+}
+
+/***** Multi-threaded stress test ******************************************************/
+
+/* Requests built concurrently for STRESS_MS on 1, 2, 4, ... up to N threads (-P), to
+ * see where msxml3 stops scaling:
+ *  - each thread in its own STA, with a new DOMDocument per request, like the sweep;
+ *  - all threads in the MTA, with a new FreeThreadedDOMDocument per request;
+ *  - all threads in the MTA, cloning one shared FreeThreadedDOMDocument skeleton.
+ * The shared skeleton is made and owned by a thread of its own that stays in the MTA
+ * until the workers are done with it.
+ */
+#define STRESS_MS 1000
+
+enum stress_kind
+{
+    STRESS_STA,
+    STRESS_FREE_THREADED,
+    STRESS_SHARED_TEMPLATE,
+    STRESS_KINDS
+};
+
+static const char * const stress_names[STRESS_KINDS] =
+{
+    "STA DOMDocument",
+    "FreeThreaded",
+    "shared FT template",
+};
+
+struct stress
+{
+    enum stress_kind kind;
+    int how;
+    HANDLE start, template_ready, done;
+    IXMLDOMDocument *skeleton;          /* STRESS_SHARED_TEMPLATE only */
+    HRESULT skeleton_failure;
+    LONG volatile ready, stop, failed_workers;
+    LONG volatile requests, failures;   /* completed before stop */
+};
+
+static HRESULT create_free_threaded_doc(IXMLDOMDocument **doc)
+{
+    return CoCreateInstance( &CLSID_FreeThreadedDOMDocument, NULL, CLSCTX_INPROC_SERVER,
+                             &IID_IXMLDOMDocument, (void**)doc );
+}
+
+static DWORD WINAPI stress_template_proc(void *arg)
+{
+    struct stress *st = arg;
+    struct soap_case skeleton_case;
+    IXMLDOMElement *soapCall = NULL;
+
+    memset(&skeleton_case, 0, sizeof(skeleton_case));
+    if (CoInitializeEx(NULL, COINIT_MULTITHREADED) == S_OK)
+    {
+        if (create_free_threaded_doc(&st->skeleton) == S_OK)
+        {
+            configure_doc(st->skeleton);
+            cur_case = &skeleton_case;
+            soapCall = build_soap_skeleton(st->skeleton, st->how);
+            cur_case = NULL;
+            free_bstrs();
+            if (soapCall == NULL)
+            {
+                IXMLDOMDocument_Release(st->skeleton);
+                st->skeleton = NULL;
+            }
+            else
+                IXMLDOMElement_Release(soapCall);
+        }
+        else
+            st->skeleton = NULL;
+        st->skeleton_failure = skeleton_case.first_failure;
+        SetEvent(st->template_ready);
+
+        WaitForSingleObject(st->done, INFINITE);
+        if (st->skeleton != NULL)
+            IXMLDOMDocument_Release(st->skeleton);
+        free_interned_bstrs();
+        CoUninitialize();
+    }
+    else
+        SetEvent(st->template_ready);
+    return 0;
+}
+
+/* Build one request; returns FALSE if not even a document could be had */
+static BOOL stress_request(struct stress *st)
+{
+    IXMLDOMDocument *doc;
+    IXMLDOMElement *soapCall;
+    HRESULT hr;
+
+    if (st->kind == STRESS_SHARED_TEMPLATE)
+    {
+        int bstrs_mark = mark_bstrs();
+
+        if ((soapCall = clone_skeleton(st->skeleton, &doc)) == NULL)
+            return FALSE;
+        if (st->skeleton_failure != S_OK)
+            note_hr(st->skeleton_failure);
+        finish_soap(doc, soapCall, st->how);
+        release_bstrs(bstrs_mark);
+        IXMLDOMElement_Release(soapCall);
+        IXMLDOMDocument_Release(doc);
+        return TRUE;
+    }
+    hr = (st->kind == STRESS_STA ? create_doc(&doc) : create_free_threaded_doc(&doc));
+    if (hr != S_OK)
+        return FALSE;
+    configure_doc(doc);
+    test_build_soap(doc, st->how);
     IXMLDOMDocument_Release(doc);
+    return TRUE;
+}
+
+static DWORD WINAPI stress_worker_proc(void *arg)
+{
+    struct stress *st = arg;
+    LONG requests = 0, failures = 0;
+    HRESULT hr;
+
+    hr = (st->kind == STRESS_STA ? CoInitialize(NULL)
+                                 : CoInitializeEx(NULL, COINIT_MULTITHREADED));
+    if (hr != S_OK)
+    {
+        InterlockedIncrement(&st->failed_workers);
+        InterlockedIncrement(&st->ready);
+        return 1;
+    }
+    skip_rating = TRUE;
+    InterlockedIncrement(&st->ready);
+    WaitForSingleObject(st->start, INFINITE);
+
+    while (!st->stop)
+    {
+        struct soap_case c;
+
+        memset(&c, 0, sizeof(c));
+        cur_case = &c;
+        if (!stress_request(st))
+            c.first_failure = E_FAIL;
+        cur_case = NULL;
+        if (st->stop) break;        /* finished too late to count */
+        requests++;
+        if (c.first_failure != S_OK) failures++;
+    }
+    InterlockedExchangeAdd(&st->requests, requests);
+    InterlockedExchangeAdd(&st->failures, failures);
+    free_bstrs();
+    free_interned_bstrs();
     CoUninitialize();
     return 0;
 }
+
+/* Run nthreads workers for STRESS_MS; returns the requests per second, or < 0 */
+static double stress_run(enum stress_kind kind, int how, int nthreads, LONG *failures)
+{
+    struct stress st;
+    HANDLE owner = NULL, *threads = malloc(nthreads * sizeof(*threads));
+    double start, ms;
+    int i, started;
+
+    assert(threads != NULL);
+    memset(&st, 0, sizeof(st));
+    st.kind = kind;
+    st.how = how;
+    st.start = CreateEventA(NULL, TRUE, FALSE, NULL);
+    st.template_ready = CreateEventA(NULL, TRUE, FALSE, NULL);
+    st.done = CreateEventA(NULL, TRUE, FALSE, NULL);
+
+    if (kind == STRESS_SHARED_TEMPLATE)
+    {
+        if ((owner = CreateThread(NULL, 0, stress_template_proc, &st, 0, NULL)) != NULL)
+            WaitForSingleObject(st.template_ready, INFINITE);
+        if (st.skeleton == NULL)
+            nthreads = 0;
+    }
+    for (started = 0; started < nthreads; started++)
+    {
+        threads[started] = CreateThread(NULL, 0, stress_worker_proc, &st, 0, NULL);
+        if (threads[started] == NULL) break;
+    }
+    while (st.ready < started)
+        Sleep(1);
+
+    start = now_ms();
+    SetEvent(st.start);
+    Sleep(STRESS_MS);
+    st.stop = TRUE;
+    ms = now_ms() - start;
+    for (i = 0; i < started; i++)
+    {
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+    }
+    SetEvent(st.done);
+    if (owner != NULL)
+    {
+        WaitForSingleObject(owner, INFINITE);
+        CloseHandle(owner);
+    }
+    CloseHandle(st.start);
+    CloseHandle(st.template_ready);
+    CloseHandle(st.done);
+    free(threads);
+
+    *failures = st.failures;
+    if (started < nthreads || started == 0 || st.failed_workers > 0)
+        return -1.0;
+    return 1000.0 * st.requests / ms;
+}
+
+/* Print the requests per second of each kind, and their scaling over one thread */
+static BOOL stress_test(int how, int max_threads)
+{
+    double single[STRESS_KINDS];
+    LONG failures[STRESS_KINDS] = { 0 };
+    BOOL ok = TRUE;
+    int kind, nthreads;
+
+    printf("========== Stress (how = %4d = 0x%04x, requests/s over %d ms): ==========\n",
+           how, how, STRESS_MS);
+    printf("%7s", "threads");
+    for (kind = 0; kind < STRESS_KINDS; kind++)
+        printf(" %21s", stress_names[kind]);
+    printf("\n");
+
+    for (nthreads = 1; nthreads <= max_threads;
+         nthreads = (nthreads < max_threads && 2 * nthreads > max_threads ? max_threads
+                                                                          : 2 * nthreads))
+    {
+        printf("%7d", nthreads);
+        for (kind = 0; kind < STRESS_KINDS; kind++)
+        {
+            LONG failed;
+            double rate = stress_run(kind, how, nthreads, &failed);
+
+            failures[kind] += failed;
+            if (nthreads == 1) single[kind] = rate;
+            if (rate < 0.0)
+            {
+                printf(" %21s", "failed");
+                ok = FALSE;
+            }
+            else if (single[kind] > 0.0)
+                printf(" %12.0f (%5.2fx)", rate, rate / single[kind]);
+            else
+                printf(" %12.0f %8s", rate, "");
+        }
+        printf("\n");
+    }
+    for (kind = 0; kind < STRESS_KINDS; kind++)
+        if (failures[kind] != 0)
+            printf("%s: %ld requests with failing calls\n", stress_names[kind],
+                   (long)failures[kind]);
+    return ok;
+}
+
+/***** Comparison of the msxml versions ************************************************/
+
+/* Build the request for how with the DOMDocument of every msxml version available (-X):
+ * its rating, whether its XML differs from that of the first class, and the median
+ * time to build the document (from CoCreateInstance to the last argument) and to
+ * serialize it with get_xml, over iterations requests.
+ */
+static BOOL compare_doc_versions(int how, int iterations)
+{
+    const struct doc_version *saved = doc_version;
+    struct soap_case ref;
+    const char *fastest = NULL;
+    double fastest_ms = 0.0;
+    BOOL have_ref = FALSE;
+    int v, i;
+
+    printf("========== msxml versions (how = %4d = 0x%04x, %d iterations): ==========\n",
+           how, how, iterations);
+    printf("%-14s %-8s %10s %10s  %s\n", "class", "rating", "build us", "get_xml us", "XML");
+    memset(&ref, 0, sizeof(ref));
+    for (v = 0; v < NB_DOC_VERSIONS; v++)
+    {
+        struct samples build, serialize;
+        struct soap_case c;
+        IXMLDOMDocument *doc;
+        const char *diff;
+
+        doc_version = &doc_versions[v];
+        if (create_doc(&doc) != S_OK)
+        {
+            printf("%-14s not available\n", doc_version->name);
+            continue;
+        }
+        /* One run for the rating and the hashes of the output... */
+        memset(&c, 0, sizeof(c));
+        c.how = how;
+        cur_case = &c;
+        configure_doc(doc);
+        test_build_soap(doc, how);
+        cur_case = NULL;
+        IXMLDOMDocument_Release(doc);
+
+        /* ...then the timed ones */
+        memset(&build, 0, sizeof(build));
+        memset(&serialize, 0, sizeof(serialize));
+        for (i = 0; i < iterations; i++)
+        {
+            int bstrs_mark = mark_bstrs();
+            IXMLDOMElement *soapCall;
+            BSTR xml = NULL;
+            double start = now_ms(), built;
+
+            if (create_doc(&doc) != S_OK) break;
+            configure_doc(doc);
+            if ((soapCall = build_soap_skeleton(doc, how)) != NULL)
+            {
+                add_soap_args(doc, soapCall, how, NULL);
+                IXMLDOMElement_Release(soapCall);
+            }
+            built = now_ms();
+            IXMLDOMDocument_get_xml(doc, &xml);
+            samples_add(&serialize, now_ms() - built);
+            samples_add(&build, built - start);
+            SysFreeString(xml);
+            IXMLDOMDocument_Release(doc);
+            release_bstrs(bstrs_mark);
+        }
+
+        if (!have_ref)
+        {
+            ref = c;
+            have_ref = TRUE;
+            diff = "reference";
+        }
+        else if (c.has_xml != ref.has_xml || (c.has_xml && c.canon_hash != ref.canon_hash))
+            diff = "differs";
+        else if (c.raw_hash != ref.raw_hash)
+            diff = "differs, same meaning";
+        else
+            diff = "same";
+        printf("%-14s %-8s %10.3f %10.3f  %s%s%s\n", doc_version->name, rating_name(c.rating),
+               1000.0 * samples_percentile(&build, 50.0),
+               1000.0 * samples_percentile(&serialize, 50.0), diff,
+               (*c.reason ? "; " : ""), c.reason);
+        if (c.rating == RATE_OPTIM &&
+            (fastest == NULL || samples_percentile(&build, 50.0) +
+                                samples_percentile(&serialize, 50.0) < fastest_ms))
+        {
+            fastest = doc_version->name;
+            fastest_ms = samples_percentile(&build, 50.0) + samples_percentile(&serialize, 50.0);
+        }
+        free(build.v);
+        free(serialize.v);
+    }
+    doc_version = saved;
+    if (fastest != NULL)
+        printf("Fastest 1_Optim: %s (%.3f us)\n", fastest, 1000.0 * fastest_ms);
+    else if (have_ref)
+        printf("No class gives 1_Optim\n");
+    return have_ref;
+}
+
+static void usage(const char *argv0)
+{
+    printf("Usage: %s [-t] [-j N] [-r] [-q] [-u] [-o FILE] [-s] [-b N]\n"
+           "          [-n NARGS] [-d DEPTH] [-v VALSIZE] [-R RESET] [-T] [-w N]\n"
+           "          [-S N] [-V K] [-x N] [-c FILE [-C]] [-M] [-P N]\n"
+           "          [-L] [-D CLASS] [-X N] [-e] HOW...\n"
+           "  where HOW is an integer 0..%d, an inclusive range LO-HI (e.g. 0-%d)\n"
+           "  or @FILE naming a file with more such values.  All values are run in\n"
+           "  one process, each on a fresh document unless -R reuses one or -T\n"
+           "  clones a prebuilt skeleton.\n"
+           "  -t    print the wall time of each case and of the whole sweep\n"
+           "  -j N  run the cases on N threads (0: one per CPU), each with its own\n"
+           "        COM apartment; the output is still printed in HOW order\n"
+           "  -r    rate the generated XML (1_Optim .. 9_FAIL, see doc/) and print\n"
+           "        a table of the ratings at the end\n"
+           "  -q    don't print the log and XML of the cases\n"
+           "  -u    print each distinct document only once, at the end, together with\n"
+           "        the HOW values producing it (implies -q)\n"
+           "  -o FILE  write the log and XML of the cases to FILE instead of stdout\n"
+           "  -s    write the XML with save() to an IStream instead of via get_xml\n"
+           "        (not with -r or -u, which need the XML as a string)\n"
+           "  -b N  benchmark: build each HOW N times and print the latency of every\n"
+           "        kind of DOM call (min/median/p99 and calls per second)\n"
+           "  -n NARGS    give Login NARGS arguments instead of the single <code/>\n"
+           "  -d DEPTH    make each argument a chain of DEPTH nested elements\n"
+           "  -v VALSIZE  put a text of VALSIZE characters in the innermost elements\n"
+           "  -R RESET    reuse documents instead of creating one per case, emptying\n"
+           "        them by RESET = remove (removeChild) or loadxml (loadXML of \"\")\n"
+           "  -T    make each request from a deep cloneNode of a prebuilt skeleton\n"
+           "        (Envelope, Body and Login) and add only the arguments; the calls\n"
+           "        of the skeleton are logged once, later cases show a summary line\n"
+           "  -w N  compare the DOM with an MXXMLWriter (SAX) generator: check that\n"
+           "        they write the same XML, then time N requests of each and show\n"
+           "        their memory use (not with -s)\n"
+           "  -S N  make N requests by splicing escaped values into XML made once with\n"
+           "        the DOM, and compare the time with building them with the DOM\n"
+           "  -V K  with -S, build every Kth request with the DOM too and check that it\n"
+           "        is identical (default 16, 0 = never)\n"
+           "  -x N  run namespace-aware XPath queries (SelectionNamespaces) N times and\n"
+           "        the same lookups as walks over the DOM, on documents with the -n\n"
+           "        arguments and with 10 and 100 times as many\n"
+           "  -c FILE  keep the results (ratings and XML hashes) in FILE, keyed by the\n"
+           "        msxml3.dll and this program, and don't rerun cases already known\n"
+           "        for the current ones (no XML is printed for those; not with -s,\n"
+           "        -u or the benchmarks)\n"
+           "  -C    with -c, run only the cases whose result changed on the previous\n"
+           "        msxml3 compared with an earlier one (e.g. while bisecting)\n"
+           "  -M    profile the allocations through IMalloc (CoRegisterMallocSpy) per\n"
+           "        case and per DOM call, with the blocks left at the end of each case\n"
+           "        and the references left on its document (only the document's, not\n"
+           "        those of elements or attributes; not with -j > 1, -c or the\n"
+           "        benchmarks)\n"
+           "  -P N  stress test: build requests for %d ms on 1, 2, 4, ... N threads (0: one\n"
+           "        per CPU) with a DOMDocument each in per-thread STAs, with\n"
+           "        FreeThreadedDOMDocuments in the MTA and by cloning one shared\n"
+           "        FreeThreadedDOMDocument skeleton, and print the requests per second\n"
+           "  -L    don't log every checked DOM call, but record the last %d of each\n"
+           "        case in memory and print them only for cases where a call failed\n"
+           "  -D CLASS    make the documents with CLASS = DOMDocument (default),\n"
+           "        DOMDocument26, DOMDocument30, DOMDocument40 or DOMDocument60\n"
+           "  -X N  build each HOW with every available one of these classes: rating,\n"
+           "        differences in the XML, and median build and get_xml times over N\n"
+           "  -e    run only one HOW of each class of values making the same calls (flags\n"
+           "        without effect cleared) and give its results to the others; the log\n"
+           "        and XML are printed for the representatives only (not with -c or -M)\n"
+           "  Some interesting values to test:\n"
+           "    2738 2739 1384 1395 1139 5491 5495 1651\n"
+           "    6839 6807 3400 1394 1398 1399 4150\n",
+           argv0, M_TEST_FLAGS_ALL, M_TEST_FLAGS_ALL, STRESS_MS, TRACE_SIZE);
+}
+
+int main(int argc, char **argv)
+{
+    struct how_list list = { NULL, 0, 0 };
+    struct soap_case *cases;
+    BOOL timing = FALSE, rate = FALSE;
+    int nworkers = 1, bench_iterations = 0, writer_iterations = 0, splice_iterations = 0;
+    int xpath_iterations = 0, stress_threads = -1, version_iterations = 0;
+    const char *cache_file = NULL;
+    BOOL changed_only = FALSE, reduce = FALSE;
+    IXMLDOMDocument *doc;
+    HRESULT hr;
+    int i, failed;
+
+    for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'
+                && !isdigit((unsigned char)argv[i][1]); i++)
+    {
+        if (!strcmp(argv[i], "-t"))
+            timing = TRUE;
+        else if (!strcmp(argv[i], "-r"))
+            rate = TRUE;
+        else if (!strcmp(argv[i], "-q"))
+            out_quiet = TRUE;
+        else if (!strcmp(argv[i], "-u"))
+            dedup = out_quiet = TRUE;
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+        {
+            if ((out_file = fopen(argv[++i], "wb")) == NULL)
+            {
+                printf("Cannot create %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "-s"))
+            save_to_stream = TRUE;
+        else if (!strcmp(argv[i], "-b") && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            bench_iterations = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            soap_nargs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-d") && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            soap_depth = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-v") && i + 1 < argc && isdigit((unsigned char)argv[i + 1][0]))
+            soap_value_len = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-w") && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            writer_iterations = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-S") && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            splice_iterations = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-V") && i + 1 < argc && isdigit((unsigned char)argv[i + 1][0]))
+            splice_verify = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-x") && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            xpath_iterations = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-T"))
+            use_templates = TRUE;
+        else if (!strcmp(argv[i], "-c") && i + 1 < argc)
+            cache_file = argv[++i];
+        else if (!strcmp(argv[i], "-C"))
+            changed_only = TRUE;
+        else if (!strcmp(argv[i], "-M"))
+            profile_allocs = TRUE;
+        else if (!strcmp(argv[i], "-L"))
+            trace_calls = TRUE;
+        else if (!strcmp(argv[i], "-e"))
+            reduce = TRUE;
+        else if (!strcmp(argv[i], "-X") && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            version_iterations = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-D") && i + 1 < argc)
+        {
+            for (doc_version = doc_versions; doc_version < doc_versions + NB_DOC_VERSIONS;
+                 doc_version++)
+                if (!strcmp(argv[i + 1], doc_version->name)) break;
+            if (doc_version == doc_versions + NB_DOC_VERSIONS)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            i++;
+        }
+        else if (!strcmp(argv[i], "-P") && i + 1 < argc && isdigit((unsigned char)argv[i + 1][0]))
+        {
+            if ((stress_threads = atoi(argv[++i])) == 0)
+                stress_threads = number_of_cpus();
+        }
+        else if (!strcmp(argv[i], "-R") && i + 1 < argc)
+        {
+            for (doc_reset = RESET_LOADXML; doc_reset > RESET_NONE; doc_reset--)
+                if (!strcmp(argv[i + 1], reset_names[doc_reset])) break;
+            if (doc_reset == RESET_NONE)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            i++;
+        }
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc && isdigit((unsigned char)argv[i + 1][0]))
+        {
+            if ((nworkers = atoi(argv[++i])) == 0)
+                nworkers = number_of_cpus();
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    for (; i < argc; i++)
+        if (!parse_how_arg(&list, argv[i]))
+            break;
+    if (i < argc || list.count == 0 ||
+        (save_to_stream && (rate || dedup || writer_iterations || splice_iterations)) ||
+        ((bench_iterations > 0 || writer_iterations > 0 || splice_iterations > 0 ||
+          xpath_iterations > 0 || stress_threads > 0 || version_iterations > 0) &&
+         nworkers != 1) ||
+        (version_iterations > 0 && save_to_stream) ||
+        (reduce && (cache_file != NULL || profile_allocs)) ||
+        (cache_file != NULL && (save_to_stream || dedup || bench_iterations ||
+                                writer_iterations || splice_iterations || xpath_iterations ||
+                                stress_threads > 0 || version_iterations > 0)) ||
+        (changed_only && cache_file == NULL) ||
+        (profile_allocs && (nworkers != 1 || cache_file != NULL || bench_iterations ||
+                            writer_iterations || splice_iterations || xpath_iterations ||
+                            stress_threads > 0 || version_iterations > 0)))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (out_file == NULL)
+        out_file = stdout;
+    if (nworkers > list.count)
+        nworkers = list.count;
+
+    cases = calloc(list.count, sizeof(*cases));
+    assert(cases != NULL);
+    for (i = 0; i < list.count; i++)
+        cases[i].how = list.hows[i];
+    free(list.hows);
+
+    InitializeCriticalSection(&doc_store.lock);
+    hr = CoInitialize( NULL );
+
+    if (hr == S_OK)
+        printf("CoInitialize successful!\n");
+    else
+    {
+        printf("Failed to init com\n");
+        return 1;
+    }
+
+    /* Check once that the class is there; each case then gets its own document */
+    hr = create_doc(&doc);
+    if (hr != S_OK)
+    {
+        printf("IXMLDOMDocument is not available (0x%08"PRIxHR")\n", hr);
+
+        CoUninitialize();
+        return 1;
+    }
+    printf("%s successfully created\n", doc_version->name);
+    IXMLDOMDocument_Release(doc);
+
+    if (profile_allocs && (hr = CoRegisterMallocSpy(&malloc_spy)) != S_OK)
+    {
+        printf("CoRegisterMallocSpy failed (0x%08"PRIxHR")\n", hr);
+        profile_allocs = FALSE;
+    }
+
+    if (bench_iterations > 0 || writer_iterations > 0 || splice_iterations > 0 ||
+        xpath_iterations > 0 || stress_threads > 0 || version_iterations > 0)
+    {
+        out_quiet = TRUE;
+        failed = FALSE;
+        for (i = 0; i < list.count; i++)
+        {
+            if (bench_iterations > 0)
+                run_benchmark(cases[i].how, bench_iterations);
+            if (writer_iterations > 0 && !compare_generators(cases[i].how, writer_iterations))
+                failed = TRUE;
+            if (splice_iterations > 0 && !splice_requests(cases[i].how, splice_iterations))
+                failed = TRUE;
+            if (xpath_iterations > 0 && !bench_xpath(cases[i].how, xpath_iterations))
+                failed = TRUE;
+            if (stress_threads > 0 && !stress_test(cases[i].how, stress_threads))
+                failed = TRUE;
+            if (version_iterations > 0 && !compare_doc_versions(cases[i].how, version_iterations))
+                failed = TRUE;
+        }
+    }
+    else if (cache_file != NULL)
+    {
+        char desc[3 * MAX_PATH];
+        ULONGLONG key = cache_key(desc, sizeof(desc));
+        struct soap_case *todo;
+        int count, ntodo = 0, done, j;
+
+        if (key == 0)
+        {
+            printf("Cannot identify msxml3.dll for the result cache\n");
+            failed = TRUE;
+            goto Cleanup;
+        }
+        load_result_cache(cache_file);
+        count = apply_result_cache(cases, list.count, key, changed_only);
+
+        /* Run the cases not in the cache, then merge them back in HOW order */
+        todo = calloc(count + 1, sizeof(*todo));
+        assert(todo != NULL);
+        for (i = 0; i < count; i++)
+            if (!cases[i].cached)
+                todo[ntodo++] = cases[i];
+        if (nworkers > ntodo)
+            nworkers = max(ntodo, 1);
+        done = run_sweep(todo, ntodo, nworkers, timing);
+        for (i = j = 0; i < count; i++)
+        {
+            if (cases[i].cached) continue;
+            if (j == done)
+            {
+                count = i;      /* stopped at a case that couldn't get a document */
+                break;
+            }
+            cases[i] = todo[j++];
+        }
+        failed = (done < ntodo);
+        if (!store_results(cache_file, key, desc, todo, done))
+            failed = TRUE;
+        free(todo);
+        if (rate)
+            print_ratings(cases, count);
+        free_result_cache();
+    }
+    else
+    {
+        int done;
+
+        if (reduce)
+        {
+            struct soap_case *reps;
+            int *rep = malloc(list.count * sizeof(*rep));
+            int nreps;
+
+            assert(rep != NULL);
+            nreps = reduce_cases(cases, list.count, &reps, rep);
+            done = run_sweep(reps, nreps, (nworkers < nreps ? nworkers : nreps), timing);
+            done = expand_cases(cases, list.count, reps, done, rep);
+            free(reps);
+            free(rep);
+        }
+        else
+            done = run_sweep(cases, list.count, nworkers, timing);
+
+        if (dedup)
+            print_distinct_docs(cases, done);
+        if (rate)
+            print_ratings(cases, done);
+        if (profile_allocs)
+            print_alloc_profile(cases, done);
+        failed = (done < list.count);
+    }
+
+Cleanup:
+    free(cases);
+    free_templates();
+    free_spare_doc();
+    if (out_file != stdout)
+        fclose(out_file);
+    free_interned_bstrs();
+    if (profile_allocs)
+    {
+        CoRevokeMallocSpy();
+        free(spy.blocks);
+    }
+    CoUninitialize();
+    return failed;
+}
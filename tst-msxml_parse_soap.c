@@ -0,0 +1,442 @@
+/* -*- Mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil -*- */
+/*
+ * XML test
+ *
+ * Copyright 2012 Ulrik Dickow
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/* This program measures the other side of the SOAP calls of tst-msxml_make_soap:
+ * parsing responses.  Responses like the one to the Login request, namespaced the same
+ * way, but with a growing number of items in the body, are parsed with
+ * IXMLDOMDocument::loadXML and with SAXXMLReader and a minimal content handler.
+ * For each size it reports the throughput, the time until the first element is
+ * available to the caller, and how much the private bytes grow while parsing.
+ */
+
+/* Build with: winegcc -m32 ... -lole32 -loleaut32 -luuid -lpsapi */
+
+#define COBJMACROS
+#define CONST_VTABLE
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "windows.h"
+
+#include "msxml2.h"
+#include "msxml2did.h"
+#include "ole2.h"
+#include "dispex.h"
+
+#include "tst-helpers.h"
+
+#ifdef OLD_WINE
+#define PRIxHR "x"
+#else
+#define PRIxHR "lx"
+#endif
+
+/* undef the #define in msxml2 so that it compiles stand-alone with -luuid */
+#undef CLSID_DOMDocument
+
+#define SOAP_ENV_URI    "http://schemas.xmlsoap.org/soap/envelope/"
+#define WSO2_URI        "http://www.wso2.org/php/xsd"
+#define XSD_URI         "http://www.w3.org/2001/XMLSchema"
+#define XSI_URI         "http://www.w3.org/2001/XMLSchema-instance"
+
+/***** Generated responses ************************************************************/
+
+struct text_buf
+{
+    char *data;
+    size_t len, size;
+};
+
+static void text_printf(struct text_buf *t, const char *fmt, ...)
+{
+    va_list args;
+    int len;
+
+    for (;;)
+    {
+        size_t room = t->size - t->len;
+
+        va_start(args, fmt);
+        len = (room ? vsnprintf(t->data + t->len, room, fmt, args) : -1);
+        va_end(args);
+        if (len >= 0 && len < room) break;
+
+        /* Old msvcrt returns -1 when truncating, so we may have to guess the size */
+        t->size = (t->size ? 2 * t->size : 4096);
+        if (len >= 0 && t->size < t->len + len + 1) t->size = t->len + len + 1;
+        t->data = realloc(t->data, t->size);
+        assert(t->data != NULL);
+    }
+    t->len += len;
+}
+
+/* A response to Login with nitems items, each of three elements, after the result */
+static BSTR make_response(int nitems, int *nelements)
+{
+    struct text_buf t = { NULL, 0, 0 };
+    BSTR xml;
+    int i;
+
+    text_printf(&t, "<?xml version=\"1.0\"?>\r\n"
+                "<SOAP-ENV:Envelope xmlns:SOAP-ENV=\"" SOAP_ENV_URI "\" "
+                "xmlns:xsd=\"" XSD_URI "\" xmlns:xsi=\"" XSI_URI "\">"
+                "<SOAP-ENV:Body><LoginResponse xmlns=\"" WSO2_URI "\">"
+                "<result xsi:type=\"xsd:string\">OK</result>");
+    for (i = 0; i < nitems; i++)
+        text_printf(&t, "<item><id>%d</id><name>Member %d &amp; co</name></item>", i, i);
+    text_printf(&t, "</LoginResponse></SOAP-ENV:Body></SOAP-ENV:Envelope>\r\n");
+
+    xml = alloc_str_from_narrow(t.data);
+    free(t.data);
+    *nelements = 4 + 3 * nitems;
+    return xml;
+}
+
+/***** A minimal SAX content handler **************************************************/
+
+/* What the handler saw of the current parse.  Only counts; the memory is sampled
+ * every so many elements to catch the largest growth during the parse.
+ */
+static struct
+{
+    double start_ms, first_element_ms;
+    int elements;
+    LONGLONG characters;
+    SIZE_T mem_base, mem_peak;
+} sax_stats;
+
+static void sample_mem(SIZE_T *peak, SIZE_T base)
+{
+    SIZE_T now = private_bytes();
+
+    if (now > base && now - base > *peak) *peak = now - base;
+}
+
+static HRESULT WINAPI handler_QueryInterface(ISAXContentHandler *iface, REFIID riid, void **obj)
+{
+    if (IsEqualIID(riid, &IID_IUnknown) || IsEqualIID(riid, &IID_ISAXContentHandler))
+    {
+        *obj = iface;
+        return S_OK;
+    }
+    *obj = NULL;
+    return E_NOINTERFACE;
+}
+
+static ULONG WINAPI handler_AddRef(ISAXContentHandler *iface)
+{
+    return 2;
+}
+
+static ULONG WINAPI handler_Release(ISAXContentHandler *iface)
+{
+    return 1;
+}
+
+static HRESULT WINAPI handler_putDocumentLocator(ISAXContentHandler *iface, ISAXLocator *locator)
+{
+    return S_OK;
+}
+
+static HRESULT WINAPI handler_startDocument(ISAXContentHandler *iface)
+{
+    return S_OK;
+}
+
+static HRESULT WINAPI handler_endDocument(ISAXContentHandler *iface)
+{
+    sample_mem(&sax_stats.mem_peak, sax_stats.mem_base);
+    return S_OK;
+}
+
+static HRESULT WINAPI handler_startPrefixMapping(ISAXContentHandler *iface,
+                                                 const WCHAR *prefix, int prefix_len,
+                                                 const WCHAR *uri, int uri_len)
+{
+    return S_OK;
+}
+
+static HRESULT WINAPI handler_endPrefixMapping(ISAXContentHandler *iface,
+                                               const WCHAR *prefix, int len)
+{
+    return S_OK;
+}
+
+static HRESULT WINAPI handler_startElement(ISAXContentHandler *iface,
+                                           const WCHAR *uri, int uri_len,
+                                           const WCHAR *local, int local_len,
+                                           const WCHAR *qname, int qname_len,
+                                           ISAXAttributes *attrs)
+{
+    if (sax_stats.elements++ == 0)
+        sax_stats.first_element_ms = now_ms() - sax_stats.start_ms;
+    if ((sax_stats.elements & 4095) == 0)
+        sample_mem(&sax_stats.mem_peak, sax_stats.mem_base);
+    return S_OK;
+}
+
+static HRESULT WINAPI handler_endElement(ISAXContentHandler *iface,
+                                         const WCHAR *uri, int uri_len,
+                                         const WCHAR *local, int local_len,
+                                         const WCHAR *qname, int qname_len)
+{
+    return S_OK;
+}
+
+static HRESULT WINAPI handler_characters(ISAXContentHandler *iface,
+                                         const WCHAR *chars, int len)
+{
+    sax_stats.characters += len;
+    return S_OK;
+}
+
+static HRESULT WINAPI handler_ignorableWhitespace(ISAXContentHandler *iface,
+                                                  const WCHAR *chars, int len)
+{
+    return S_OK;
+}
+
+static HRESULT WINAPI handler_processingInstruction(ISAXContentHandler *iface,
+                                                    const WCHAR *target, int target_len,
+                                                    const WCHAR *data, int data_len)
+{
+    return S_OK;
+}
+
+static HRESULT WINAPI handler_skippedEntity(ISAXContentHandler *iface,
+                                            const WCHAR *name, int len)
+{
+    return S_OK;
+}
+
+static const ISAXContentHandlerVtbl handler_vtbl =
+{
+    handler_QueryInterface,
+    handler_AddRef,
+    handler_Release,
+    handler_putDocumentLocator,
+    handler_startDocument,
+    handler_endDocument,
+    handler_startPrefixMapping,
+    handler_endPrefixMapping,
+    handler_startElement,
+    handler_endElement,
+    handler_characters,
+    handler_ignorableWhitespace,
+    handler_processingInstruction,
+    handler_skippedEntity
+};
+
+static ISAXContentHandler handler = { &handler_vtbl };
+
+/***** The two parsers ****************************************************************/
+
+/* The results of parsing one response once */
+struct parse_result
+{
+    double ms, first_element_ms;
+    SIZE_T mem_growth;
+    int elements;           /* as seen by the parser, to check it got everything */
+};
+
+static HRESULT parse_dom(BSTR xml, struct parse_result *res)
+{
+    IXMLDOMDocument *doc;
+    IXMLDOMNodeList *list;
+    VARIANT_BOOL ok;
+    SIZE_T base;
+    LONG len = 0;
+    HRESULT hr;
+    double start;
+
+    memset(res, 0, sizeof(*res));
+    hr = CoCreateInstance(&CLSID_DOMDocument, NULL, CLSCTX_INPROC_SERVER,
+                          &IID_IXMLDOMDocument, (void**)&doc);
+    if (hr != S_OK) return hr;
+    IXMLDOMDocument_put_preserveWhiteSpace(doc, VARIANT_FALSE);
+    IXMLDOMDocument_put_resolveExternals(doc, VARIANT_FALSE);
+    IXMLDOMDocument_put_validateOnParse(doc, VARIANT_FALSE);
+    IXMLDOMDocument_put_async(doc, VARIANT_FALSE);
+
+    base = private_bytes();
+    start = now_ms();
+    hr = IXMLDOMDocument_loadXML(doc, xml, &ok);
+    res->ms = now_ms() - start;
+    /* Nothing of the document is available before loadXML returns */
+    res->first_element_ms = res->ms;
+    sample_mem(&res->mem_growth, base);
+
+    if (hr == S_OK && ok == VARIANT_TRUE &&
+        IXMLDOMDocument_getElementsByTagName(doc, CONST_BSTR("*"), &list) == S_OK)
+    {
+        IXMLDOMNodeList_get_length(list, &len);
+        IXMLDOMNodeList_Release(list);
+    }
+    res->elements = len;
+    IXMLDOMDocument_Release(doc);
+    return (hr == S_OK && ok != VARIANT_TRUE ? E_FAIL : hr);
+}
+
+static HRESULT parse_sax(ISAXXMLReader *reader, BSTR xml, struct parse_result *res)
+{
+    VARIANT input;
+    HRESULT hr;
+
+    memset(&sax_stats, 0, sizeof(sax_stats));
+    V_VT(&input) = VT_BSTR;
+    V_BSTR(&input) = xml;
+
+    sax_stats.mem_base = private_bytes();
+    sax_stats.start_ms = now_ms();
+    hr = ISAXXMLReader_parse(reader, input);
+    res->ms = now_ms() - sax_stats.start_ms;
+    res->first_element_ms = sax_stats.first_element_ms;
+    res->mem_growth = sax_stats.mem_peak;
+    res->elements = sax_stats.elements;
+    return hr;
+}
+
+/***** Benchmark **********************************************************************/
+
+/* The response is parsed from a UTF-16 BSTR, so its size and the MB/s (of 10^6 bytes)
+ * are of UTF-16 bytes, two per character.  The memory growth is the largest seen while
+ * parsing for SAX ("peak"), but only what is left when loadXML returns ("end"), as
+ * loadXML gives no chance to sample during the parse.
+ */
+static void print_result(const char *parser, int nitems, SIZE_T bytes, struct samples *ms,
+                         struct samples *first, SIZE_T mem_growth, const char *mem_when,
+                         BOOL ok)
+{
+    double median = samples_percentile(ms, 50.0);
+
+    printf("%9d %10lu  %-13s %10.3f %10.1f %12.3f %8lu %-4s  %s\n", nitems,
+           (unsigned long)bytes, parser, median,
+           (median > 0.0 ? bytes / 1e6 / (median / 1000.0) : 0.0),
+           samples_percentile(first, 50.0), (unsigned long)(mem_growth / 1024), mem_when,
+           (ok ? "" : "FAILED"));
+}
+
+/* Parse a response of nitems items repeats times with each parser; only the parses
+ * that succeed and see every element are counted.
+ */
+static BOOL bench_size(ISAXXMLReader *reader, int nitems, int repeats)
+{
+    struct samples ms[2], first[2];
+    SIZE_T growth[2] = { 0, 0 };
+    BOOL ok[2] = { TRUE, TRUE };
+    int i, k, nelements;
+    BSTR xml = make_response(nitems, &nelements);
+    SIZE_T bytes = SysStringByteLen(xml);
+    memset(ms, 0, sizeof(ms));
+    memset(first, 0, sizeof(first));
+    for (i = 0; i < repeats; i++)
+        for (k = 0; k < 2; k++)
+        {
+            struct parse_result res;
+            HRESULT hr = (k == 0 ? parse_dom(xml, &res) : parse_sax(reader, xml, &res));
+
+            if (hr != S_OK || res.elements != nelements)
+            {
+                if (ok[k])
+                    printf("%s of %d items: 0x%08"PRIxHR", %d of %d elements\n",
+                           (k == 0 ? "loadXML" : "SAXXMLReader"), nitems, hr,
+                           res.elements, nelements);
+                ok[k] = FALSE;
+                continue;
+            }
+            samples_add(&ms[k], res.ms);
+            samples_add(&first[k], res.first_element_ms);
+            if (res.mem_growth > growth[k]) growth[k] = res.mem_growth;
+        }
+
+    print_result("loadXML", nitems, bytes, &ms[0], &first[0], growth[0], "end", ok[0]);
+    print_result("SAXXMLReader", nitems, bytes, &ms[1], &first[1], growth[1], "peak", ok[1]);
+    for (k = 0; k < 2; k++)
+    {
+        free(ms[k].v);
+        free(first[k].v);
+    }
+    SysFreeString(xml);
+    return (ok[0] && ok[1]);
+}
+
+static void usage(const char *argv0)
+{
+    printf("Usage: %s [-r REPEATS] [-m MAXITEMS]\n"
+           "  Parse SOAP responses of 1, 10, 100, ... up to MAXITEMS items (default 100000)\n"
+           "  REPEATS times each (default 5) with loadXML and with SAXXMLReader, and print\n"
+           "  the size in UTF-16 bytes, the median time, MB/s (10^6 UTF-16 bytes per\n"
+           "  second), the median time to the first element and the growth of the\n"
+           "  private bytes: the largest while parsing for SAX (peak), what is left\n"
+           "  when loadXML returns for the DOM (end).\n",
+           argv0);
+}
+
+int main(int argc, char **argv)
+{
+    ISAXXMLReader *reader;
+    HRESULT hr;
+    int i, nitems, repeats = 5, max_items = 100000;
+    BOOL ok = TRUE;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-r") && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            repeats = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-m") && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            max_items = atoi(argv[++i]);
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    hr = CoInitialize( NULL );
+    if (hr != S_OK)
+    {
+        printf("Failed to init com\n");
+        return 1;
+    }
+
+    hr = CoCreateInstance(&CLSID_SAXXMLReader, NULL, CLSCTX_INPROC_SERVER,
+                          &IID_ISAXXMLReader, (void**)&reader);
+    if (hr != S_OK)
+    {
+        printf("SAXXMLReader is not available (0x%08"PRIxHR")\n", hr);
+        CoUninitialize();
+        return 1;
+    }
+    ISAXXMLReader_putContentHandler(reader, &handler);
+
+    printf("%9s %10s  %-13s %10s %10s %12s %13s\n", "items", "bytes", "parser",
+           "median ms", "MB/s", "1st elem ms", "mem KB");
+    for (nitems = 1; nitems <= max_items; nitems *= 10)
+        ok = bench_size(reader, nitems, repeats) && ok;
+
+    ISAXXMLReader_Release(reader);
+    CoUninitialize();
+    return !ok;
+}
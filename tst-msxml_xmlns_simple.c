@@ -21,7 +21,10 @@
 
 /* Parts of this file come from Wine's dlls/msxml3/tests/domdoc.c */
 
-/* This program tests a few fixed cases of defining namespaces. */
+/* This program tests a few fixed cases of defining namespaces.
+ * With -k it instead benchmarks documents declaring many namespace prefixes, with -t
+ * documents nested very deeply.
+ */
 
 /* Build with: winegcc -m32 ... -lole32 -loleaut32 -luuid */
 
@@ -29,6 +32,8 @@
 #define CONST_VTABLE
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #include "windows.h"
@@ -40,62 +45,28 @@
 
 #include "wine/debug.h"
 
+#include "tst-helpers.h"
+
 /* undef the #define in msxml2 so that it compiles stand-alone with -luuid */
 #undef CLSID_DOMDocument
 
 #define RELEASE_ELEMENT(e) \
     do { if (e != NULL) IXMLDOMElement_Release(e); } while(0)
 
-/***** Begin BSTR helper functions from dlls/msxml3/tests/domdoc.c *********************/
-
-static BSTR alloc_str_from_narrow(const char *str)
-{
-    int len = MultiByteToWideChar(CP_ACP, 0, str, -1, NULL, 0);
-    BSTR ret = SysAllocStringLen(NULL, len - 1);  /* NUL character added automatically */
-    MultiByteToWideChar(CP_ACP, 0, str, -1, ret, len);
-    return ret;
-}
-
-static BSTR alloced_bstrs[256];
-static int alloced_bstrs_count;
-
-static BSTR _bstr_(const char *str)
-{
-    assert(alloced_bstrs_count < sizeof(alloced_bstrs)/sizeof(alloced_bstrs[0]));
-    alloced_bstrs[alloced_bstrs_count] = alloc_str_from_narrow(str);
-    return alloced_bstrs[alloced_bstrs_count++];
-}
-
-static void free_bstrs(void)
-{
-    int i;
-    for (i = 0; i < alloced_bstrs_count; i++)
-        SysFreeString(alloced_bstrs[i]);
-    alloced_bstrs_count = 0;
-}
-
-static VARIANT _variantbstr_(const char *str)
-{
-    VARIANT v;
-    V_VT(&v) = VT_BSTR;
-    V_BSTR(&v) = _bstr_(str);
-    return v;
-}
-
-/***** End BSTR helper functions from dlls/msxml3/tests/domdoc.c ***********************/
+static BOOL quiet;  /* the benchmarks don't log the calls */
 
 /* Helper macro to log the important calls, including interesting arguments, no matter
  * the return status, but returning from the current function if HRESULT hr is not ok.
  */
 #define CHK_HR(fmt,args...) \
-    do { printf("%-5s <-- " fmt , (hr == S_OK ? "ok" : \
-                                 (hr == S_FALSE ? "False" : "FAIL")) , ##args); \
+    do { if (!quiet) printf("%-5s <-- " fmt , (hr == S_OK ? "ok" : \
+                                             (hr == S_FALSE ? "False" : "FAIL")) , ##args); \
          if (hr != S_OK) goto CleanReturn; \
     } while(0)
 
 #define PRT_HR(fmt,args...) \
-    do { printf("%-5s <-- " fmt , (hr == S_OK ? "ok" : \
-                                 (hr == S_FALSE ? "False" : "FAIL")) , ##args); \
+    do { if (!quiet) printf("%-5s <-- " fmt , (hr == S_OK ? "ok" : \
+                                             (hr == S_FALSE ? "False" : "FAIL")) , ##args); \
     } while(0)
 
 /* Easy way of setting an attribute, but without any connection to namespaces
@@ -156,7 +127,7 @@ static HRESULT set_attr_cplx(IXMLDOMElement *elem, const char *attr, const char
     const char *nsURI = "http://www.w3.org/2000/xmlns/";
     HRESULT hr;
     IXMLDOMDocument *doc;
-    IXMLDOMAttribute *attr_node, *attr_old;
+    IXMLDOMAttribute *attr_node = NULL, *attr_old = NULL;
 
     /* 0) Find doc from given element */
     hr = IXMLDOMElement_get_ownerDocument(elem, &doc);
@@ -168,7 +139,7 @@ static HRESULT set_attr_cplx(IXMLDOMElement *elem, const char *attr, const char
 
     /* 1) Create attribute node */
     hr = create_attribute_ns(doc, attr, nsURI, &attr_node);
-    if (hr != S_OK) return hr;
+    if (hr != S_OK) goto CleanReturn;
 
     /* 2) Put attribute value into attribute node */
     hr = IXMLDOMAttribute_put_nodeValue(attr_node, _variantbstr_(str_val));
@@ -179,6 +150,9 @@ static HRESULT set_attr_cplx(IXMLDOMElement *elem, const char *attr, const char
     CHK_HR("    setAttributeNode\n");
 
 CleanReturn:
+    if (attr_old != NULL) IXMLDOMAttribute_Release(attr_old);
+    if (attr_node != NULL) IXMLDOMAttribute_Release(attr_node);
+    IXMLDOMDocument_Release(doc);
     return hr;
 }
 
@@ -379,9 +353,331 @@ CleanReturn:
 }
 
 
-int main(void)
+/***** Namespace breadth benchmark ***************************************************/
+
+/* BREADTH_LEVELS nested elements each bind the K prefixes p0..pK-1, every level to other
+ * URIs (rebinding them as in Test 02), and the innermost one has K children pI:leaf in
+ * the namespaces of the innermost bindings.  The bindings are made either with xmlns:pI
+ * attributes (set_attr_cplx) or implicitly, by attributes pI:a made with createNode in
+ * the namespace.  Timed are building the tree, get_xml of the whole and get_namespaceURI
+ * of the leaves; the latter per call, so that a lookup scanning all the bindings in
+ * scope shows up as a cost growing with K.
+ */
+#define BREADTH_LEVELS  3
+#define BENCH_REPEATS   5
+
+enum ns_decl
+{
+    DECL_XMLNS,
+    DECL_CREATE_NODE,
+    DECL_COUNT
+};
+
+static const char * const decl_names[DECL_COUNT] = { "xmlns attributes", "createNode attrs" };
+
+static void breadth_uri(char *buf, int level, int prefix)
+{
+    sprintf(buf, "urn:level%d:ns%d", level, prefix);
+}
+
+static HRESULT declare_prefix(IXMLDOMDocument *doc, IXMLDOMElement *elem, enum ns_decl decl,
+                              int prefix, const char *uri)
+{
+    IXMLDOMAttribute *attr_node, *attr_old = NULL;
+    char name[32];
+    HRESULT hr;
+
+    if (decl == DECL_XMLNS)
+    {
+        sprintf(name, "xmlns:p%d", prefix);
+        return set_attr_cplx(elem, name, uri);
+    }
+    sprintf(name, "p%d:a", prefix);
+    hr = create_attribute_ns(doc, name, uri, &attr_node);
+    if (hr != S_OK) return hr;
+    hr = IXMLDOMAttribute_put_nodeValue(attr_node, _variantbstr_("v"));
+    if (hr == S_OK)
+        hr = IXMLDOMElement_setAttributeNode(elem, attr_node, &attr_old);
+    if (attr_old != NULL) IXMLDOMAttribute_Release(attr_old);
+    IXMLDOMAttribute_Release(attr_node);
+    return hr;
+}
+
+/* Build the tree into root and leaves[0..k-1]; what was made must be released also
+ * on failure.
+ */
+static BOOL build_breadth_tree(IXMLDOMDocument *doc, int k, enum ns_decl decl,
+                               IXMLDOMElement **root, IXMLDOMElement **leaves)
+{
+    IXMLDOMElement *parent = NULL, *elem;
+    char name[32], uri[64];
+    BOOL ok = FALSE;
+    int level, i;
+
+    *root = NULL;
+    memset(leaves, 0, k * sizeof(*leaves));
+    for (level = 0; level < BREADTH_LEVELS; level++)
+    {
+        if ((elem = create_elem_ns(doc, "level", "")) == NULL)
+            goto CleanReturn;
+        for (i = 0; i < k; i++)
+        {
+            breadth_uri(uri, level, i);
+            if (declare_prefix(doc, elem, decl, i, uri) != S_OK) break;
+        }
+        if (i < k ||
+            (parent != NULL && IXMLDOMElement_appendChild(parent, (IXMLDOMNode*)elem, NULL) != S_OK))
+        {
+            IXMLDOMElement_Release(elem);
+            goto CleanReturn;
+        }
+        if (parent == NULL)
+        {
+            *root = elem;
+            IXMLDOMElement_AddRef(elem);
+        }
+        else
+            IXMLDOMElement_Release(parent);
+        parent = elem;
+    }
+    for (i = 0; i < k; i++)
+    {
+        sprintf(name, "p%d:leaf", i);
+        breadth_uri(uri, BREADTH_LEVELS - 1, i);
+        if ((leaves[i] = create_elem_ns(doc, name, uri)) == NULL ||
+            IXMLDOMElement_appendChild(parent, (IXMLDOMNode*)leaves[i], NULL) != S_OK)
+            goto CleanReturn;
+    }
+    ok = TRUE;
+
+CleanReturn:
+    RELEASE_ELEMENT(parent);
+    return ok;
+}
+
+static int count_xmlns(const WCHAR *xml)
+{
+    static const WCHAR xmlnsW[] = {'x','m','l','n','s'};
+    int count = 0;
+
+    for (; *xml; xml++)
+        if (xml[0] == 'x' && !memcmp(xml, xmlnsW, sizeof(xmlnsW)))
+            count++;
+    return count;
+}
+
+static void bench_breadth(int max_k)
+{
+    int k, i, r;
+    enum ns_decl decl;
+
+    printf("========== Namespace breadth (%d levels of K prefixes, K leaves) ==========\n",
+           BREADTH_LEVELS);
+    printf("%6s %-18s %10s %10s %12s %8s %10s  %s\n", "K", "bindings", "build ms",
+           "get_xml ms", "nsURI us", "xmlns", "XML chars", "leaf URI");
+    for (k = 1; k <= max_k; k *= 10)
+        for (decl = 0; decl < DECL_COUNT; decl++)
+        {
+            IXMLDOMElement *root, **leaves = malloc(k * sizeof(*leaves));
+            struct samples build, xml_ms, uri_ms;
+            int xmlns = 0, len = 0;
+            BOOL uri_ok = TRUE;
+            char uri[64];
+
+            assert(leaves != NULL);
+            memset(&build, 0, sizeof(build));
+            memset(&xml_ms, 0, sizeof(xml_ms));
+            memset(&uri_ms, 0, sizeof(uri_ms));
+            breadth_uri(uri, BREADTH_LEVELS - 1, k - 1);
+            for (r = 0; r < BENCH_REPEATS; r++)
+            {
+                IXMLDOMDocument *doc = create_doc();
+                double start;
+                BSTR str;
+                BOOL built;
+
+                if (doc == NULL) break;
+                start = now_ms();
+                built = build_breadth_tree(doc, k, decl, &root, leaves);
+                samples_add(&build, now_ms() - start);
+                if (built)
+                {
+                    start = now_ms();
+                    if (IXMLDOMElement_get_xml(root, &str) == S_OK)
+                    {
+                        samples_add(&xml_ms, now_ms() - start);
+                        xmlns = count_xmlns(str);
+                        len = SysStringLen(str);
+                        SysFreeString(str);
+                    }
+                    start = now_ms();
+                    for (i = 0; i < k; i++)
+                    {
+                        str = NULL;
+                        IXMLDOMElement_get_namespaceURI(leaves[i], &str);
+                        if (i == k - 1)
+                            uri_ok = uri_ok && str != NULL && !lstrcmpW(str, _bstr_(uri));
+                        SysFreeString(str);
+                    }
+                    samples_add(&uri_ms, (now_ms() - start) / k);
+                }
+                else
+                    uri_ok = FALSE;
+                RELEASE_ELEMENT(root);
+                for (i = 0; i < k; i++)
+                    RELEASE_ELEMENT(leaves[i]);
+                IXMLDOMDocument_Release(doc);
+                free_bstrs();
+            }
+            printf("%6d %-18s %10.3f %10.3f %12.3f %8d %10d  %s\n", k, decl_names[decl],
+                   samples_percentile(&build, 50.0), samples_percentile(&xml_ms, 50.0),
+                   1000.0 * samples_percentile(&uri_ms, 50.0), xmlns, len,
+                   (uri_ok ? "ok" : "WRONG"));
+            free(build.v);
+            free(xml_ms.v);
+            free(uri_ms.v);
+            free(leaves);
+        }
+}
+
+/***** Tree depth benchmark ***************************************************/
+
+/* A chain of depth elements "node", all made with create_elem_ns in the namespace
+ * urn:deep, which is bound at the root only: the others inherit it, so get_xml has to
+ * find out from their ancestors that their xmlns is redundant (as in Test 03).
+ * Timed are building the chain, get_xml of the whole, get_namespaceURI of the deepest
+ * node, and a late set_attr_cplx of the same xmlns on it, once connected.  Building and
+ * get_xml are also shown per node: growing with the depth, they are quadratic in it.
+ */
+#define DEPTH_URI "urn:deep"
+
+static IXMLDOMElement *build_chain(IXMLDOMDocument *doc, int depth, IXMLDOMElement **leaf)
+{
+    IXMLDOMElement *root, *parent, *elem;
+    int i;
+
+    *leaf = NULL;
+    if ((root = create_elem_ns(doc, "node", DEPTH_URI)) == NULL)
+        return NULL;
+    parent = root;
+    IXMLDOMElement_AddRef(parent);
+    for (i = 1; i < depth; i++)
+    {
+        if ((elem = create_elem_ns(doc, "node", DEPTH_URI)) == NULL ||
+            IXMLDOMElement_appendChild(parent, (IXMLDOMNode*)elem, NULL) != S_OK)
+        {
+            RELEASE_ELEMENT(elem);
+            IXMLDOMElement_Release(parent);
+            IXMLDOMElement_Release(root);
+            return NULL;
+        }
+        IXMLDOMElement_Release(parent);
+        parent = elem;
+    }
+    *leaf = parent;
+    return root;
+}
+
+static void bench_depth(int max_depth)
+{
+    int depth, r;
+
+    printf("========== Tree depth (chain of nodes, namespace bound at the root) ==========\n");
+    printf("%7s %10s %9s %10s %9s %6s %10s %12s  %s\n", "depth", "build ms", "us/node",
+           "get_xml ms", "us/node", "xmlns", "nsURI us", "set_attr us", "leaf URI");
+    for (depth = 10; depth <= max_depth; depth *= 10)
+    {
+        struct samples build, xml_ms, uri_us, attr_us;
+        int repeats = (depth >= 10000 ? 1 : BENCH_REPEATS), xmlns = 0;
+        BOOL uri_ok = TRUE;
+
+        memset(&build, 0, sizeof(build));
+        memset(&xml_ms, 0, sizeof(xml_ms));
+        memset(&uri_us, 0, sizeof(uri_us));
+        memset(&attr_us, 0, sizeof(attr_us));
+        for (r = 0; r < repeats; r++)
+        {
+            IXMLDOMDocument *doc = create_doc();
+            IXMLDOMElement *root, *leaf;
+            double start;
+            BSTR str;
+
+            if (doc == NULL) break;
+            start = now_ms();
+            root = build_chain(doc, depth, &leaf);
+            samples_add(&build, now_ms() - start);
+            if (root == NULL)
+            {
+                uri_ok = FALSE;
+                IXMLDOMDocument_Release(doc);
+                break;
+            }
+
+            start = now_ms();
+            if (IXMLDOMElement_get_xml(root, &str) == S_OK)
+            {
+                samples_add(&xml_ms, now_ms() - start);
+                xmlns = count_xmlns(str);
+                SysFreeString(str);
+            }
+
+            str = NULL;
+            start = now_ms();
+            IXMLDOMElement_get_namespaceURI(leaf, &str);
+            samples_add(&uri_us, 1000.0 * (now_ms() - start));
+            uri_ok = uri_ok && str != NULL && !lstrcmpW(str, _bstr_(DEPTH_URI));
+            SysFreeString(str);
+
+            start = now_ms();
+            set_attr_cplx(leaf, "xmlns", DEPTH_URI);
+            samples_add(&attr_us, 1000.0 * (now_ms() - start));
+
+            IXMLDOMElement_Release(leaf);
+            IXMLDOMElement_Release(root);
+            IXMLDOMDocument_Release(doc);
+            free_bstrs();
+        }
+        printf("%7d %10.3f %9.3f %10.3f %9.3f %6d %10.3f %12.3f  %s\n", depth,
+               samples_percentile(&build, 50.0), 1000.0 * samples_percentile(&build, 50.0) / depth,
+               samples_percentile(&xml_ms, 50.0), 1000.0 * samples_percentile(&xml_ms, 50.0) / depth,
+               xmlns, samples_percentile(&uri_us, 50.0), samples_percentile(&attr_us, 50.0),
+               (uri_ok ? "ok" : "WRONG"));
+        free(build.v);
+        free(xml_ms.v);
+        free(uri_us.v);
+        free(attr_us.v);
+        if (!uri_ok) break;
+    }
+}
+
+static void usage(const char *argv0)
+{
+    printf("Usage: %s [-k MAXK] [-t MAXDEPTH]\n"
+           "  Without options, run the fixed namespace tests 01-04.\n"
+           "  -k MAXK  benchmark documents binding K = 1, 10, ... MAXK prefixes on %d\n"
+           "        nested levels, with xmlns attributes and with createNode attributes\n"
+           "  -t MAXDEPTH  benchmark chains of nodes of depth 10, 100, ... MAXDEPTH\n"
+           "        (e.g. 100000) in a namespace bound at the root\n",
+           argv0, BREADTH_LEVELS);
+}
+
+int main(int argc, char **argv)
 {
     HRESULT hr;
+    int i, max_k = 0, max_depth = 0;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-k") && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            max_k = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            max_depth = atoi(argv[++i]);
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
 
     hr = CoInitialize( NULL );
 
@@ -393,7 +689,16 @@ int main(void)
         return 1;
     }
 
-    test_xmlns();
+    if (max_k > 0 || max_depth > 0)
+    {
+        quiet = TRUE;
+        if (max_k > 0)
+            bench_breadth(max_k);
+        if (max_depth > 0)
+            bench_depth(max_depth);
+    }
+    else
+        test_xmlns();
 
     CoUninitialize();
     return 0;
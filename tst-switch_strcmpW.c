@@ -1,10 +1,14 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #include "windows.h"
 /* #include "wine/unicode.h" */
 #include "wine/debug.h"
 
+#include "tst-helpers.h"
+
 /***** Begin wine/unicode.h was in wine <= 3.4 but isn't in 10.15.  Inline from 3.4 source here. ******/
 
 static inline int strcmpW( const WCHAR *str1, const WCHAR *str2 )
@@ -22,49 +26,190 @@ static inline int strncmpW( const WCHAR *str1, const WCHAR *str2, int n )
 
 /***** End of str*cmpW from old wine/unicode.h *****/
 
-/***** Begin BSTR helper functions from dlls/msxml3/tests/domdoc.c *********************/
-static BSTR alloc_str_from_narrow(const char *str)
+/***** SSE2 and AVX2 versions of strcmpW and strncmpW *****/
+
+/* These compare 8 (SSE2) or 16 (AVX2) UTF-16 units per step with unaligned loads.
+ * A load may read beyond the terminating NUL, which is harmless as long as it stays
+ * within the page (the next page might not be mapped), so close to the end of a page
+ * they go one unit at a time until both strings have passed it.
+ * They return exactly what the scalar versions return, not just the same sign.
+ */
+#if defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_SIMD_STRCMPW
+#endif
+
+#define CMP_PAGE_SIZE 4096
+
+static inline BOOL load_ok(const WCHAR *str, size_t bytes)
 {
-    int len = MultiByteToWideChar(CP_ACP, 0, str, -1, NULL, 0);
-    BSTR ret = SysAllocStringLen(NULL, len - 1);  /* NUL character added automatically */
-    MultiByteToWideChar(CP_ACP, 0, str, -1, ret, len);
-    return ret;
+    return ((UINT_PTR)str & (CMP_PAGE_SIZE - 1)) <= CMP_PAGE_SIZE - bytes;
 }
 
-static BSTR alloced_bstrs[256];
-static int alloced_bstrs_count;
+#ifdef HAVE_SIMD_STRCMPW
 
-static BSTR _bstr_(const char *str)
+/* Bit 2*i (and 2*i+1) of the result is set if unit i differs or ends str1 */
+__attribute__((target("sse2")))
+static inline unsigned int stop_mask_sse2(const WCHAR *str1, const WCHAR *str2)
 {
-    assert(alloced_bstrs_count < sizeof(alloced_bstrs)/sizeof(alloced_bstrs[0]));
-    alloced_bstrs[alloced_bstrs_count] = alloc_str_from_narrow(str);
-    return alloced_bstrs[alloced_bstrs_count++];
+    __m128i a = _mm_loadu_si128((const __m128i*)str1);
+    __m128i b = _mm_loadu_si128((const __m128i*)str2);
+
+    return ((~_mm_movemask_epi8(_mm_cmpeq_epi16(a, b)) & 0xffff) |
+            _mm_movemask_epi8(_mm_cmpeq_epi16(a, _mm_setzero_si128())));
 }
 
-static void free_bstrs(void)
+__attribute__((target("avx2")))
+static inline unsigned int stop_mask_avx2(const WCHAR *str1, const WCHAR *str2)
+{
+    __m256i a = _mm256_loadu_si256((const __m256i*)str1);
+    __m256i b = _mm256_loadu_si256((const __m256i*)str2);
+
+    return (~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi16(a, b)) |
+            (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi16(a, _mm256_setzero_si256())));
+}
+
+/* The four kernels only differ in the mask function and the step, so make them from
+ * one template.  The scalar step is also used for the rest of a strncmpW.
+ */
+#define DEFINE_STRCMPW_SIMD(isa, units) \
+__attribute__((target(#isa))) \
+static int strcmpW_##isa( const WCHAR *str1, const WCHAR *str2 ) \
+{ \
+    for (;;) \
+    { \
+        if (load_ok(str1, units * sizeof(WCHAR)) && load_ok(str2, units * sizeof(WCHAR))) \
+        { \
+            unsigned int mask = stop_mask_##isa(str1, str2); \
+            if (mask) \
+            { \
+                int i = __builtin_ctz(mask) / 2; \
+                return str1[i] - str2[i]; \
+            } \
+            str1 += units; str2 += units; \
+        } \
+        else \
+        { \
+            if (!*str1 || *str1 != *str2) return *str1 - *str2; \
+            str1++; str2++; \
+        } \
+    } \
+} \
+\
+__attribute__((target(#isa))) \
+static int strncmpW_##isa( const WCHAR *str1, const WCHAR *str2, int n ) \
+{ \
+    while (n >= units) \
+    { \
+        if (load_ok(str1, units * sizeof(WCHAR)) && load_ok(str2, units * sizeof(WCHAR))) \
+        { \
+            unsigned int mask = stop_mask_##isa(str1, str2); \
+            if (mask) \
+            { \
+                int i = __builtin_ctz(mask) / 2; \
+                return str1[i] - str2[i]; \
+            } \
+            str1 += units; str2 += units; n -= units; \
+        } \
+        else \
+        { \
+            if (!*str1 || *str1 != *str2) return *str1 - *str2; \
+            str1++; str2++; n--; \
+        } \
+    } \
+    return strncmpW(str1, str2, n); \
+}
+
+DEFINE_STRCMPW_SIMD(sse2, 8)
+DEFINE_STRCMPW_SIMD(avx2, 16)
+
+#endif /* HAVE_SIMD_STRCMPW */
+
+/* The implementations, scalar first as the reference; supported is set by init_strcmpW */
+static struct strcmpW_impl
 {
+    const char *name;
+    int (*cmp)( const WCHAR *str1, const WCHAR *str2 );
+    int (*ncmp)( const WCHAR *str1, const WCHAR *str2, int n );
+    BOOL supported;
+} strcmpW_impls[] =
+{
+    { "scalar", strcmpW, strncmpW, TRUE },
+#ifdef HAVE_SIMD_STRCMPW
+    { "sse2", strcmpW_sse2, strncmpW_sse2, FALSE },
+    { "avx2", strcmpW_avx2, strncmpW_avx2, FALSE },
+#endif
+};
+
+#define NB_IMPLS (sizeof(strcmpW_impls) / sizeof(strcmpW_impls[0]))
+
+static void init_strcmpW(void)
+{
+#ifdef HAVE_SIMD_STRCMPW
     int i;
-    for (i = 0; i < alloced_bstrs_count; i++)
-        SysFreeString(alloced_bstrs[i]);
-    alloced_bstrs_count = 0;
+
+    __builtin_cpu_init();
+    for (i = 1; i < NB_IMPLS; i++)
+        strcmpW_impls[i].supported = (!strcmp(strcmpW_impls[i].name, "sse2")
+                                      ? __builtin_cpu_supports("sse2")
+                                      : __builtin_cpu_supports("avx2"));
+#endif
 }
-/***** End BSTR helper functions from dlls/msxml3/tests/domdoc.c ***********************/
 
-void test_pair(const char *nameA, const char *nsURI_A)
+static const WCHAR xmlnsW[]  = {'x','m','l','n','s',0};
+static const WCHAR xmlnscW[] = {'x','m','l','n','s',':'};
+static const WCHAR w3xmlns[] = { 'h','t','t','p',':','/','/', 'w','w','w','.','w','3','.',
+    'o','r','g','/','2','0','0','0','/','x','m','l','n','s','/',0 };
+
+#define XMLNSC_LEN  (sizeof(xmlnscW) / sizeof(WCHAR))
+#define W3XMLNS_LEN (sizeof(w3xmlns) / sizeof(WCHAR) - 1)
+
+/* Classify a (name, namespace URI) pair of an attribute with the strcmpW and strncmpW
+ * of impl: 0 if neither the name is xmlns[:...] nor the URI the reserved W3C xmlns URI,
+ * 1 if just one of them is, 2 if both are.
+ */
+static int classify_xmlns_pair(const struct strcmpW_impl *impl,
+                               const WCHAR *name, const WCHAR *uri)
+{
+    return ((!impl->cmp(name, xmlnsW) || !impl->ncmp(name, xmlnscW, XMLNSC_LEN)) +
+            !impl->cmp(uri, w3xmlns));
+}
+
+/* Classify count pairs at once, with the verdicts of classify_xmlns_pair in verdicts[].
+ * The lengths are looked at first: only a name of length 5, or of at least 6 with a
+ * colon at 5, can be xmlns[:...], and only a URI of exactly the length of the reserved
+ * one can be it, so most pairs are decided without comparing any characters.  What is
+ * left is a memcmp of a known size against the constant strings.
+ * The BSTRs must not contain NULs, or SysStringLen wouldn't agree with strcmpW.
+ */
+static void classify_xmlns_pairs(const BSTR *names, const BSTR *uris, int count,
+                                 BYTE *verdicts)
 {
-    static const WCHAR xmlnsW[]  = {'x','m','l','n','s',0};
-    static const WCHAR xmlnscW[] = {'x','m','l','n','s',':'};
-    static const WCHAR w3xmlns[] = { 'h','t','t','p',':','/','/', 'w','w','w','.','w','3','.',
-        'o','r','g','/','2','0','0','0','/','x','m','l','n','s','/',0 };
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        const WCHAR *name = names[i];
+        UINT name_len = SysStringLen(names[i]);
+
+        verdicts[i] = ((name_len >= XMLNSC_LEN - 1 &&
+                        !memcmp(name, xmlnscW, (XMLNSC_LEN - 1) * sizeof(WCHAR)) &&
+                        (name_len == XMLNSC_LEN - 1 || name[XMLNSC_LEN - 1] == ':')) +
+                       (SysStringLen(uris[i]) == W3XMLNS_LEN &&
+                        !memcmp(uris[i], w3xmlns, W3XMLNS_LEN * sizeof(WCHAR))));
+    }
+}
 
+void test_pair(const char *nameA, const char *nsURI_A)
+{
     BSTR name = _bstr_(nameA);
     BSTR namespaceURI = _bstr_(nsURI_A);
+    BYTE verdict;
 
     printf("======== name = \"%s\", nsURI = \"%s\" ============\n", nameA, nsURI_A);
 
-    switch((!strcmpW(name, xmlnsW) ||
-            !strncmpW(name, xmlnscW, sizeof(xmlnscW)/sizeof(WCHAR))) +
-           !strcmpW(namespaceURI, w3xmlns))
+    classify_xmlns_pairs(&name, &namespaceURI, 1, &verdict);
+    switch(verdict)
     {
     case 0: /* Neither xmlns nor the reserved W3C xmlns URI */
         printf("attribute nodes with namespaces not yet fully supported.\n");
@@ -82,8 +227,302 @@ void test_pair(const char *nameA, const char *nsURI_A)
     free_bstrs();
 }
 
-int main(void)
+/***** Correctness of the SIMD versions against the scalar ones *****/
+
+/* Random strings from a small alphabet, so that long common prefixes are frequent.
+ * 0xffff and a surrogate check that differences are computed unsigned like the scalar.
+ */
+static void random_strW(WCHAR *str, int len)
+{
+    static const WCHAR alphabet[] = { 'a', 'b', 'x', 0xd800, 0xffff };
+    int i;
+
+    for (i = 0; i < len; i++)
+        str[i] = alphabet[rand() % (sizeof(alphabet) / sizeof(alphabet[0]))];
+    str[len] = 0;
+}
+
+static int check_result(const struct strcmpW_impl *impl, const char *func, int got,
+                        int expected, const WCHAR *str1, const WCHAR *str2, int n)
+{
+    if (got == expected) return 0;
+    printf("%s %s(%s, %s, %d) = %d, expected %d\n", impl->name, func,
+           wine_dbgstr_w(str1), wine_dbgstr_w(str2), n, got, expected);
+    return 1;
+}
+
+/* Compare every implementation with the scalar one on random pairs of strings.
+ * The first string of each pair ends right before a page that isn't accessible,
+ * so a kernel reading too far past its NUL crashes instead of passing by luck.
+ */
+static int test_strcmpW_impls(int rounds)
+{
+    const int max_len = 80;
+    char *pages = VirtualAlloc(NULL, 2 * CMP_PAGE_SIZE, MEM_COMMIT, PAGE_READWRITE);
+    WCHAR *page_end = (WCHAR*)(pages + CMP_PAGE_SIZE);
+    WCHAR *buf2 = malloc((max_len + 40) * sizeof(WCHAR));
+    DWORD old_protect;
+    int i, k, failures = 0;
+
+    assert(pages != NULL && buf2 != NULL);
+    VirtualProtect(pages + CMP_PAGE_SIZE, CMP_PAGE_SIZE, PAGE_NOACCESS, &old_protect);
+    srand(26226);
+
+    for (i = 0; i < rounds; i++)
+    {
+        int len1 = rand() % max_len, len2, pos;
+        WCHAR *str1 = page_end - (len1 + 1), *str2 = buf2 + rand() % 32;
+        int ns[5];
+
+        /* str2 is str1 with at most one change: a different unit, cut or extended */
+        random_strW(str1, len1);
+        memcpy(str2, str1, (len1 + 1) * sizeof(WCHAR));
+        len2 = len1;
+        pos = (len1 ? rand() % len1 : 0);
+        switch (rand() % 4)
+        {
+        case 0: break;
+        case 1: if (len1) str2[pos] = (str2[pos] == 'a' ? 0xffff : 'a'); break;
+        case 2: str2[len2 = pos] = 0; break;
+        case 3: random_strW(str2 + len1, len2 = rand() % 8); len2 += len1; break;
+        }
+        ns[0] = 0; ns[1] = 1; ns[2] = pos; ns[3] = len1 + 1; ns[4] = rand() % (max_len + 8);
+
+        for (k = 1; k < NB_IMPLS; k++)
+        {
+            const struct strcmpW_impl *impl = &strcmpW_impls[k];
+            int j;
+
+            if (!impl->supported) continue;
+            failures += check_result(impl, "strcmpW", impl->cmp(str1, str2),
+                                     strcmpW(str1, str2), str1, str2, -1);
+            failures += check_result(impl, "strcmpW", impl->cmp(str2, str1),
+                                     strcmpW(str2, str1), str2, str1, -1);
+            for (j = 0; j < 5; j++)
+            {
+                failures += check_result(impl, "strncmpW", impl->ncmp(str1, str2, ns[j]),
+                                         strncmpW(str1, str2, ns[j]), str1, str2, ns[j]);
+                failures += check_result(impl, "strncmpW", impl->ncmp(str2, str1, ns[j]),
+                                         strncmpW(str2, str1, ns[j]), str2, str1, ns[j]);
+            }
+        }
+    }
+    for (k = 0; k < NB_IMPLS; k++)
+        printf("%-6s %s\n", strcmpW_impls[k].name,
+               (!strcmpW_impls[k].supported ? "not supported by this CPU" :
+                k == 0 ? "reference" : "checked"));
+    printf("%d random pairs, %d failures\n", rounds, failures);
+
+    VirtualFree(pages, 0, MEM_RELEASE);
+    free(buf2);
+    return failures;
+}
+
+/***** Benchmark over the names and URIs seen in SOAP requests *****/
+
+static const char * const bench_names[] =
+{
+    "xmlns", "xmlns:SOAP-ENV", "xmlns:xsd", "xmlns:xsi", "SOAP-ENV:encodingStyle",
+    "SOAP-ENV:mustUnderstand", "xsi:type", "xsi:nil", "id", "href", "xml:lang", "code",
+    "xmlnsfoo", "klubnummer", "eksportkode",
+};
+
+static const char * const bench_uris[] =
+{
+    "http://www.w3.org/2000/xmlns/", "http://www.w3.org/2000/xmlns",
+    "http://schemas.xmlsoap.org/soap/envelope/", "http://schemas.xmlsoap.org/soap/encoding/",
+    "http://www.w3.org/2001/XMLSchema", "http://www.w3.org/2001/XMLSchema-instance",
+    "http://www.wso2.org/php/xsd", "http://www.w3.org/XML/1998/namespace",
+    "urn:schemas-microsoft-com:datatypes", "",
+};
+
+#define NB_BENCH_NAMES (sizeof(bench_names) / sizeof(bench_names[0]))
+#define NB_BENCH_URIS  (sizeof(bench_uris) / sizeof(bench_uris[0]))
+
+/* Time the checks of test_pair with each implementation: strcmpW and strncmpW of every
+ * name against xmlns and xmlns:, and strcmpW of every URI against the W3C xmlns URI.
+ */
+static void bench_strcmpW_impls(int rounds)
+{
+    BSTR names[NB_BENCH_NAMES], uris[NB_BENCH_URIS];
+    double names_ms[NB_IMPLS], uris_ms[NB_IMPLS];
+    volatile int sink = 0;
+    int i, j, k;
+
+    for (i = 0; i < NB_BENCH_NAMES; i++) names[i] = _bstr_(bench_names[i]);
+    for (i = 0; i < NB_BENCH_URIS; i++) uris[i] = _bstr_(bench_uris[i]);
+
+    printf("%-6s %14s %9s %14s %9s\n", "impl", "names ns/pair", "speedup", "URIs ns/cmp",
+           "speedup");
+    for (k = 0; k < NB_IMPLS; k++)
+    {
+        const struct strcmpW_impl *impl = &strcmpW_impls[k];
+        double start;
+
+        if (!impl->supported) continue;
+
+        start = now_ms();
+        for (j = 0; j < rounds; j++)
+            for (i = 0; i < NB_BENCH_NAMES; i++)
+                sink += (!impl->cmp(names[i], xmlnsW) ||
+                         !impl->ncmp(names[i], xmlnscW, XMLNSC_LEN));
+        names_ms[k] = now_ms() - start;
+
+        start = now_ms();
+        for (j = 0; j < rounds; j++)
+            for (i = 0; i < NB_BENCH_URIS; i++)
+                sink += !impl->cmp(uris[i], w3xmlns);
+        uris_ms[k] = now_ms() - start;
+
+        printf("%-6s %14.2f %8.2fx %14.2f %8.2fx\n", impl->name,
+               1e6 * names_ms[k] / ((double)rounds * NB_BENCH_NAMES),
+               names_ms[0] / names_ms[k],
+               1e6 * uris_ms[k] / ((double)rounds * NB_BENCH_URIS),
+               uris_ms[0] / uris_ms[k]);
+    }
+    free_bstrs();
+}
+
+/* Names and URIs close to the reserved ones, for checking the batch classifier */
+static const char * const check_names[] =
+{
+    "xmlns", "xmlns:", "xmlns:a", "xmln", "xmlnsx", "xmlns_a", "Xmlns", "xmlns:xmlns", "",
+};
+
+static const char * const check_uris[] =
+{
+    "http://www.w3.org/2000/xmlns/", "http://www.w3.org/2000/xmlns", "http://www.w3.org/2000/xmlns//",
+    "http://www.w3.org/2000/xmlnsX", "Http://www.w3.org/2000/xmlns/", "xmlns", "",
+};
+
+#define NB_CHECK_NAMES (sizeof(check_names) / sizeof(check_names[0]))
+#define NB_CHECK_URIS  (sizeof(check_uris) / sizeof(check_uris[0]))
+
+/* Compare classify_xmlns_pairs with the scalar classify_xmlns_pair on every combination
+ * of the names and URIs of the benchmark and the near misses above.
+ */
+static int test_classify_xmlns_pairs(void)
+{
+    int nnames = NB_BENCH_NAMES + NB_CHECK_NAMES, nuris = NB_BENCH_URIS + NB_CHECK_URIS;
+    BSTR *names = malloc(nnames * nuris * sizeof(BSTR));
+    BSTR *uris = malloc(nnames * nuris * sizeof(BSTR));
+    BYTE *verdicts = malloc(nnames * nuris);
+    int i, j, count = 0, failures = 0;
+
+    assert(names != NULL && uris != NULL && verdicts != NULL);
+    for (i = 0; i < nnames; i++)
+        for (j = 0; j < nuris; j++)
+        {
+            names[count] = _ibstr_(i < NB_BENCH_NAMES ? bench_names[i]
+                                                      : check_names[i - NB_BENCH_NAMES]);
+            uris[count++] = _ibstr_(j < NB_BENCH_URIS ? bench_uris[j]
+                                                      : check_uris[j - NB_BENCH_URIS]);
+        }
+
+    classify_xmlns_pairs(names, uris, count, verdicts);
+    for (i = 0; i < count; i++)
+    {
+        int expected = classify_xmlns_pair(&strcmpW_impls[0], names[i], uris[i]);
+
+        if (verdicts[i] == expected) continue;
+        printf("classify_xmlns_pairs(%s, %s) = %d, expected %d\n",
+               wine_dbgstr_w(names[i]), wine_dbgstr_w(uris[i]), verdicts[i], expected);
+        failures++;
+    }
+    printf("%d name/URI pairs classified in a batch, %d failures\n", count, failures);
+
+    free(verdicts);
+    free(uris);
+    free(names);
+    free_interned_bstrs();
+    return failures;
+}
+
+/* Classify count pairs drawn at random from the benchmark names and URIs, one at a time
+ * with each strcmpW implementation and all at once with classify_xmlns_pairs.
+ */
+static void bench_classify_xmlns_pairs(int count)
+{
+    BSTR *names = malloc(count * sizeof(BSTR)), *uris = malloc(count * sizeof(BSTR));
+    BYTE *verdicts = malloc(count);
+    double start, ms, scalar_ms = 0.0;
+    int i, k, matches;
+
+    assert(names != NULL && uris != NULL && verdicts != NULL);
+    srand(26226);
+    for (i = 0; i < count; i++)
+    {
+        names[i] = _ibstr_(bench_names[rand() % NB_BENCH_NAMES]);
+        uris[i] = _ibstr_(bench_uris[rand() % NB_BENCH_URIS]);
+    }
+
+    printf("%-22s %12s %12s %9s\n", "classifier", "ns/pair", "Mpairs/s", "speedup");
+    for (k = 0; k <= NB_IMPLS; k++)
+    {
+        const char *name = (k < NB_IMPLS ? strcmpW_impls[k].name : "classify_xmlns_pairs");
+
+        if (k < NB_IMPLS && !strcmpW_impls[k].supported) continue;
+
+        start = now_ms();
+        if (k < NB_IMPLS)
+            for (i = 0; i < count; i++)
+                verdicts[i] = classify_xmlns_pair(&strcmpW_impls[k], names[i], uris[i]);
+        else
+            classify_xmlns_pairs(names, uris, count, verdicts);
+        ms = now_ms() - start;
+        if (k == 0) scalar_ms = ms;
+
+        for (i = matches = 0; i < count; i++)
+            matches += (verdicts[i] == 2);
+        printf("%-22s %12.2f %12.2f %8.2fx  (%d ok matches)\n", name, 1e6 * ms / count,
+               (ms > 0.0 ? count / ms / 1000.0 : 0.0), (ms > 0.0 ? scalar_ms / ms : 0.0),
+               matches);
+    }
+
+    free(verdicts);
+    free(uris);
+    free(names);
+    free_interned_bstrs();
+}
+
+static void usage(const char *argv0)
 {
+    printf("Usage: %s [-c N] [-b N] [-p N]\n"
+           "  Without options, classify the name/nsURI pairs of the original test.\n"
+           "  -c N  check the SSE2/AVX2 strcmpW and strncmpW against the scalar ones\n"
+           "        on N random pairs of strings, and the batch classifier against\n"
+           "        the strcmpW checks of test_pair\n"
+           "  -b N  benchmark the implementations, N rounds over names and URIs\n"
+           "  -p N  benchmark classifying N name/URI pairs, one by one and batched\n",
+           argv0);
+}
+
+int main(int argc, char **argv)
+{
+    int i, failures = 0;
+    BOOL done = FALSE;
+
+    init_strcmpW();
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-c") && i + 1 < argc && atoi(argv[i + 1]) > 0)
+        {
+            failures += test_strcmpW_impls(atoi(argv[++i]));
+            failures += test_classify_xmlns_pairs();
+        }
+        else if (!strcmp(argv[i], "-b") && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            bench_strcmpW_impls(atoi(argv[++i]));
+        else if (!strcmp(argv[i], "-p") && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            bench_classify_xmlns_pairs(atoi(argv[++i]));
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        done = TRUE;
+    }
+    if (done) return (failures != 0);
+
     test_pair("xmlns", "http://www.w3.org/2000/xmlns/"); /* Legal */
     test_pair("xmlns:foo", "http://www.w3.org/2000/xmlns/"); /* Legal */
 